@@ -0,0 +1,119 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/castops.h"
+
+#include <cstdint>
+
+#include "glog/logging.h"
+#include "absl/types/span.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace pysc2 {
+namespace {
+
+// Converts values from `begin` onwards one at a time.
+template <typename FloatType>
+void ToInt32Tail(absl::Span<const FloatType> values, int begin,
+                 absl::Span<int32_t> output) {
+  for (int i = begin; i < values.size(); ++i) {
+    output[i] = ToInt32(values[i]);
+  }
+}
+
+template <typename FloatType>
+using ToInt32Fn = void (*)(absl::Span<const FloatType>, absl::Span<int32_t>);
+
+template <typename FloatType>
+ToInt32Fn<FloatType> SelectToInt32() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuSupportsAvx()) {
+    return ToInt32Avx;
+  }
+#endif
+  return ToInt32Scalar;
+}
+
+}  // namespace
+
+void ToInt32(absl::Span<const float> values, absl::Span<int32_t> output) {
+  static const ToInt32Fn<float> to_int32 = SelectToInt32<float>();
+  to_int32(values, output);
+}
+
+void ToInt32(absl::Span<const double> values, absl::Span<int32_t> output) {
+  static const ToInt32Fn<double> to_int32 = SelectToInt32<double>();
+  to_int32(values, output);
+}
+
+void ToInt32Scalar(absl::Span<const float> values, absl::Span<int32_t> output) {
+  CHECK_EQ(output.size(), values.size());
+  ToInt32Tail(values, 0, output);
+}
+
+void ToInt32Scalar(absl::Span<const double> values,
+                   absl::Span<int32_t> output) {
+  CHECK_EQ(output.size(), values.size());
+  ToInt32Tail(values, 0, output);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+bool CpuSupportsAvx() { return __builtin_cpu_supports("avx"); }
+
+// Values whose truncation fits in an int32 are those in [-2^31, 2^31); the
+// ordered comparisons are false for NaN. Every other value is replaced by
+// -2^31 before the truncating conversion, so it becomes INT32_MIN whatever
+// the conversion itself does out of range.
+__attribute__((target("avx"))) void ToInt32Avx(absl::Span<const float> values,
+                                                absl::Span<int32_t> output) {
+  CHECK_EQ(output.size(), values.size());
+  const __m256 lo = _mm256_set1_ps(-2147483648.0f);
+  const __m256 hi = _mm256_set1_ps(2147483648.0f);
+  int i = 0;
+  for (; i + 8 <= values.size(); i += 8) {
+    __m256 v = _mm256_loadu_ps(values.data() + i);
+    __m256 in_range = _mm256_and_ps(_mm256_cmp_ps(v, lo, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(v, hi, _CMP_LT_OQ));
+    v = _mm256_blendv_ps(lo, v, in_range);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output.data() + i),
+                        _mm256_cvttps_epi32(v));
+  }
+  ToInt32Tail(values, i, output);
+}
+
+__attribute__((target("avx"))) void ToInt32Avx(absl::Span<const double> values,
+                                                absl::Span<int32_t> output) {
+  CHECK_EQ(output.size(), values.size());
+  const __m256d lo = _mm256_set1_pd(-2147483648.0);
+  const __m256d hi = _mm256_set1_pd(2147483648.0);
+  int i = 0;
+  for (; i + 4 <= values.size(); i += 4) {
+    __m256d v = _mm256_loadu_pd(values.data() + i);
+    __m256d in_range = _mm256_and_pd(_mm256_cmp_pd(v, lo, _CMP_GE_OQ),
+                                     _mm256_cmp_pd(v, hi, _CMP_LT_OQ));
+    v = _mm256_blendv_pd(lo, v, in_range);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output.data() + i),
+                     _mm256_cvttpd_epi32(v));
+  }
+  ToInt32Tail(values, i, output);
+}
+
+#endif
+
+}  // namespace pysc2
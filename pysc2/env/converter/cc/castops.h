@@ -16,9 +16,12 @@
 #define PYSC2_ENV_CONVERTER_CC_CASTOPS_H_
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <type_traits>
 
+#include "absl/types/span.h"
+
 namespace pysc2 {
 
 // Emulating X86-64's behavior of casting long double, double or float to
@@ -70,6 +73,23 @@ int32_t ToInt32(FloatType value) {
   }
 }
 
+// ToInt32 over every value, giving bit identical results. `output` must be
+// the same size as `values`. Uses SIMD where the CPU supports it.
+void ToInt32(absl::Span<const float> values, absl::Span<int32_t> output);
+void ToInt32(absl::Span<const double> values, absl::Span<int32_t> output);
+
+// The individual kernels, exposed for testing. The SIMD ones are only
+// compiled for x86 and must only be called when the CPU supports them.
+void ToInt32Scalar(absl::Span<const float> values, absl::Span<int32_t> output);
+void ToInt32Scalar(absl::Span<const double> values,
+                   absl::Span<int32_t> output);
+
+#if defined(__x86_64__) || defined(__i386__)
+void ToInt32Avx(absl::Span<const float> values, absl::Span<int32_t> output);
+void ToInt32Avx(absl::Span<const double> values, absl::Span<int32_t> output);
+bool CpuSupportsAvx();
+#endif
+
 }  // namespace pysc2
 
 #endif  // PYSC2_ENV_CONVERTER_CC_CASTOPS_H_
@@ -0,0 +1,125 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/castops.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+
+namespace pysc2 {
+namespace {
+
+template <typename FloatType>
+using ToInt32Fn = void (*)(absl::Span<const FloatType>, absl::Span<int32_t>);
+
+// Values around every boundary of the conversion: zeros, subnormals, the
+// int32 limits and their neighbours, infinities and NaNs of either sign.
+template <typename FloatType>
+std::vector<FloatType> EdgeValues() {
+  using Limits = std::numeric_limits<FloatType>;
+  // Rounded to the nearest FloatType, which is what makes these interesting.
+  const double centers[] = {
+      0, 0.5, 1, 1.5, 255, 2147483520.0, 2147483647.0, 2147483648.0,
+      4294967296.0, 1e10, 1e30, Limits::denorm_min(), Limits::min(),
+      Limits::max(), Limits::infinity()};
+  std::vector<FloatType> values = {
+      Limits::quiet_NaN(), -Limits::quiet_NaN(), Limits::signaling_NaN(),
+      static_cast<FloatType>(-2147483648.5),
+      static_cast<FloatType>(-2147483649.0)};
+  for (FloatType center : centers) {
+    for (FloatType sign : {FloatType{1}, FloatType{-1}}) {
+      FloatType value = sign * center;
+      values.push_back(value);
+      values.push_back(std::nextafter(value, Limits::infinity()));
+      values.push_back(std::nextafter(value, -Limits::infinity()));
+    }
+  }
+  return values;
+}
+
+// Edge values followed by random bit patterns, which cover every exponent.
+template <typename FloatType, typename BitsType>
+std::vector<FloatType> TestValues() {
+  std::vector<FloatType> values = EdgeValues<FloatType>();
+  std::mt19937_64 rng(17);
+  std::uniform_int_distribution<BitsType> bits;
+  for (int i = 0; i < 100000; ++i) {
+    BitsType b = bits(rng);
+    FloatType value;
+    std::memcpy(&value, &b, sizeof(value));
+    values.push_back(value);
+  }
+  return values;
+}
+
+template <typename FloatType>
+void ExpectMatchesScalar(ToInt32Fn<FloatType> to_int32,
+                         const std::vector<FloatType>& values) {
+  // Every length up to a few SIMD blocks, so each kernel's tail is covered,
+  // then everything at once.
+  for (int size = 0; size <= 40; ++size) {
+    absl::Span<const FloatType> span(values.data(), size);
+    std::vector<int32_t> actual(size, 7);
+    to_int32(span, absl::MakeSpan(actual));
+    for (int i = 0; i < size; ++i) {
+      ASSERT_EQ(actual[i], ToInt32(values[i])) << "value " << values[i];
+    }
+  }
+  std::vector<int32_t> actual(values.size(), 7);
+  to_int32(values, absl::MakeSpan(actual));
+  for (int i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(actual[i], ToInt32(values[i])) << "value " << values[i];
+  }
+}
+
+TEST(CastOpsTest, ToInt32SaturatesToIntMin) {
+  EXPECT_EQ(ToInt32(-2147483648.0), std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(ToInt32(2147483647.9), std::numeric_limits<int32_t>::max());
+  EXPECT_EQ(ToInt32(2147483648.0), std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(ToInt32(-2147483648.5), std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(ToInt32(std::numeric_limits<float>::quiet_NaN()),
+            std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(ToInt32(-1.9f), -1);
+}
+
+TEST(CastOpsTest, DispatchedMatchesScalar) {
+  ExpectMatchesScalar<float>(ToInt32, TestValues<float, uint32_t>());
+  ExpectMatchesScalar<double>(ToInt32, TestValues<double, uint64_t>());
+}
+
+TEST(CastOpsTest, ScalarKernelMatchesScalar) {
+  ExpectMatchesScalar<float>(ToInt32Scalar, TestValues<float, uint32_t>());
+  ExpectMatchesScalar<double>(ToInt32Scalar, TestValues<double, uint64_t>());
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+TEST(CastOpsTest, AvxMatchesScalar) {
+  if (!CpuSupportsAvx()) {
+    GTEST_SKIP() << "AVX not supported";
+  }
+  ExpectMatchesScalar<float>(ToInt32Avx, TestValues<float, uint32_t>());
+  ExpectMatchesScalar<double>(ToInt32Avx, TestValues<double, uint64_t>());
+}
+#endif
+
+}  // namespace
+}  // namespace pysc2
@@ -14,10 +14,18 @@
 
 #include "pysc2/env/converter/cc/convert_obs.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
 #include "pysc2/env/converter/cc/castops.h"
 #include "pysc2/env/converter/cc/game_data/uint8_lookup.h"
 #include "pysc2/env/converter/cc/general_order_ids.h"
@@ -25,7 +33,9 @@
 #include "pysc2/env/converter/cc/raw_actions_encoder.h"
 #include "pysc2/env/converter/cc/raw_camera.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "s2clientprotocol/raw.pb.h"
+#include "s2clientprotocol/spatial.pb.h"
 
 namespace pysc2 {
 namespace {
@@ -80,6 +90,218 @@ static std::array<int, 35> kUnitFeaturesToMask({
     45,  // shield_upgrade_level.
 });
 
+// The raw units matrix stored feature-major, i.e. as one contiguous column of
+// `num_rows` values per feature, so that each feature group is written by a
+// simple loop over units.
+class RawUnitColumns {
+ public:
+  RawUnitColumns(absl::Span<int32_t> data, int num_rows)
+      : data_(data), num_rows_(num_rows) {}
+
+  absl::Span<int32_t> column(int j) {
+    return absl::MakeSpan(data_.data() + j * num_rows_, num_rows_);
+  }
+
+  void ZeroRow(int i) {
+    for (int k = i; k < data_.size(); k += num_rows_) {
+      data_[k] = 0;
+    }
+  }
+
+ private:
+  absl::Span<int32_t> data_;
+  int num_rows_;
+};
+
+// The fields of the first unit_count units that are transformed before being
+// written, gathered out of the protos into flat arrays.
+struct RawUnitFields {
+  explicit RawUnitFields(int unit_count)
+      : x(unit_count),
+        y(unit_count),
+        radius(unit_count),
+        health(unit_count),
+        health_max(unit_count),
+        shield(unit_count),
+        shield_max(unit_count),
+        energy(unit_count),
+        energy_max(unit_count),
+        build_progress(unit_count),
+        facing(unit_count),
+        weapon_cooldown(unit_count),
+        tags(unit_count),
+        is_on_screen(unit_count),
+        order_counts(unit_count),
+        ability_ids{std::vector<int>(unit_count), std::vector<int>(unit_count),
+                    std::vector<int>(unit_count), std::vector<int>(unit_count)},
+        order_progress{std::vector<float>(unit_count),
+                       std::vector<float>(unit_count)} {}
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> radius;
+  std::vector<float> health;
+  std::vector<float> health_max;
+  std::vector<float> shield;
+  std::vector<float> shield_max;
+  std::vector<float> energy;
+  std::vector<float> energy_max;
+  std::vector<float> build_progress;
+  std::vector<float> facing;
+  std::vector<float> weapon_cooldown;
+  std::vector<uint64_t> tags;
+  std::vector<uint8_t> is_on_screen;
+  std::vector<int> order_counts;
+  // Of the first 4 and first 2 orders respectively; 0 past order_counts.
+  std::array<std::vector<int>, 4> ability_ids;
+  std::array<std::vector<float>, 2> order_progress;
+};
+
+// The single pass over the protos of units [begin, end): copies the fields
+// which are written as they are straight into their columns, and gathers the
+// rest into `fields`. `unit_table` must hold the units of `raw` with more
+// than 33 features and is unused otherwise.
+template <int kTier>
+void GatherRawUnitFields(const SC2APIProtocol::ObservationRaw& raw, int begin,
+                         int end, bool is_raw, const UnitTable* unit_table,
+                         RawUnitFields* fields, RawUnitColumns* columns) {
+  absl::Span<int32_t> unit_type = columns->column(0);
+  absl::Span<int32_t> alliance = columns->column(1);
+  absl::Span<int32_t> cargo_space_taken = columns->column(5);
+  absl::Span<int32_t> display_type = columns->column(10);
+  absl::Span<int32_t> owner = columns->column(11);
+  absl::Span<int32_t> cloak = columns->column(16);
+  absl::Span<int32_t> is_selected = columns->column(17);
+  absl::Span<int32_t> is_blip = columns->column(18);
+  absl::Span<int32_t> is_powered = columns->column(19);
+  absl::Span<int32_t> mineral_contents = columns->column(20);
+  absl::Span<int32_t> vespene_contents = columns->column(21);
+  absl::Span<int32_t> cargo_space_max = columns->column(22);
+  absl::Span<int32_t> assigned_harvesters = columns->column(23);
+  absl::Span<int32_t> ideal_harvesters = columns->column(24);
+  absl::Span<int32_t> order_length = columns->column(26);
+  absl::Span<int32_t> tag = columns->column(29);
+  for (int i = begin; i < end; ++i) {
+    const SC2APIProtocol::Unit& u = raw.units(i);
+    // Match unit_vec order
+    unit_type[i] = u.unit_type();
+    alliance[i] = u.alliance();  // Self = 1, Ally = 2, Neutral = 3, Enemy = 4
+    cargo_space_taken[i] = u.cargo_space_taken();
+    // Visible = 1; Snapshot = 2; Hidden = 3
+    display_type[i] = u.display_type();
+    owner[i] = u.owner();  //  1 - 15;    16 = neutral
+    cloak[i] = u.cloak();  // Cloaked = 1; CloakedDetected = 2; NotCloaked = 3
+    is_selected[i] = u.is_selected();
+    is_blip[i] = u.is_blip();
+    is_powered[i] = u.is_powered();
+    mineral_contents[i] = u.mineral_contents();
+    vespene_contents[i] = u.vespene_contents();
+    // Not populated for enemies or neutral
+    cargo_space_max[i] = u.cargo_space_max();
+    assigned_harvesters[i] = u.assigned_harvesters();
+    ideal_harvesters[i] = u.ideal_harvesters();
+    order_length[i] = u.orders_size();
+    tag[i] = is_raw ? u.tag() : 0;
+
+    if constexpr (kTier > 33) {
+      columns->column(30)[i] = u.is_hallucination();
+      columns->column(31)[i] = u.buff_ids_size() >= 1 ? u.buff_ids(0) : 0;
+      columns->column(32)[i] = u.buff_ids_size() >= 2 ? u.buff_ids(1) : 0;
+      if (u.has_add_on_tag()) {
+        if (const UnitTable::Entry* add_on =
+                unit_table->FindCurrent(u.add_on_tag())) {
+          columns->column(33)[i] = add_on->unit_type;
+        }
+      }
+    }
+    if constexpr (kTier > 34) {
+      columns->column(34)[i] = u.is_active();
+    }
+    if constexpr (kTier > 45) {
+      columns->column(41)[i] = u.buff_duration_remain();
+      columns->column(42)[i] = u.buff_duration_max();
+      columns->column(43)[i] = u.attack_upgrade_level();
+      columns->column(44)[i] = u.armor_upgrade_level();
+      columns->column(45)[i] = u.shield_upgrade_level();
+    }
+
+    fields->x[i] = u.pos().x();
+    fields->y[i] = u.pos().y();
+    fields->radius[i] = u.radius();
+    fields->health[i] = u.health();
+    fields->health_max[i] = u.health_max();
+    fields->shield[i] = u.shield();
+    fields->shield_max[i] = u.shield_max();
+    fields->energy[i] = u.energy();
+    fields->energy_max[i] = u.energy_max();
+    fields->build_progress[i] = u.build_progress();
+    fields->facing[i] = u.facing();
+    fields->weapon_cooldown[i] = u.weapon_cooldown();
+    fields->tags[i] = u.tag();
+    fields->is_on_screen[i] = u.is_on_screen();
+    fields->order_counts[i] = u.orders_size();
+    for (int k = 0; k < u.orders_size() && k < 4; ++k) {
+      fields->ability_ids[k][i] = u.orders(k).ability_id();
+    }
+    for (int k = 0; k < u.orders_size() && k < 2; ++k) {
+      fields->order_progress[k][i] = u.orders(k).progress();
+    }
+  }
+}
+
+// Writes the health, shield and energy features and their ratios, the build
+// progress, facing and weapon cooldown of units [begin, end).
+void ConvertRawUnitFields(const RawUnitFields& fields, int begin, int end,
+                          RawUnitColumns* columns) {
+  const int count = end - begin;
+  auto to_int = [&](const std::vector<float>& values, int j) {
+    ToInt32(absl::MakeConstSpan(values).subspan(begin, count),
+            columns->column(j).subspan(begin, count));
+  };
+  to_int(fields.health, 2);
+  to_int(fields.shield, 3);
+  to_int(fields.energy, 4);
+  to_int(fields.facing, 14);
+  to_int(fields.weapon_cooldown, 25);
+
+  // The scaled values are computed in double, as the per unit conversion did.
+  std::vector<double> scaled(count);
+  for (int i = 0; i < count; ++i) {
+    scaled[i] = static_cast<double>(fields.build_progress[begin + i]) * 100.0;
+  }
+  ToInt32(scaled, columns->column(6).subspan(begin, count));
+
+  // Resume API order
+  auto ratio = [&](const std::vector<float>& values,
+                   const std::vector<float>& maxes, int j) {
+    for (int i = 0; i < count; ++i) {
+      int k = begin + i;
+      scaled[i] = maxes[k] > 0 ? values[k] / maxes[k] * 255.0 : 0.0;
+    }
+    ToInt32(scaled, columns->column(j).subspan(begin, count));
+  };
+  ratio(fields.health, fields.health_max, 7);
+  ratio(fields.shield, fields.shield_max, 8);
+  ratio(fields.energy, fields.energy_max, 9);
+}
+
+// WorldToMinimapPx and WorldToMinimapDistance over the gathered positions of
+// units [begin, end).
+void MinimapPositions(const RawUnitFields& fields, int begin, int end,
+                      const SC2APIProtocol::Size2DI& map_size,
+                      const SC2APIProtocol::Size2DI& raw_resolution,
+                      RawUnitColumns* columns) {
+  const int count = end - begin;
+  WorldToMinimapPx(absl::MakeConstSpan(fields.x).subspan(begin, count),
+                   absl::MakeConstSpan(fields.y).subspan(begin, count),
+                   map_size, raw_resolution,
+                   columns->column(12).subspan(begin, count),
+                   columns->column(13).subspan(begin, count));
+  WorldToMinimapDistance(
+      absl::MakeConstSpan(fields.radius).subspan(begin, count), map_size,
+      raw_resolution, columns->column(15).subspan(begin, count));
+}
+
 }  // namespace
 
 dm_env_rpc::v1::Tensor GameLoop(
@@ -139,19 +361,25 @@ dm_env_rpc::v1::Tensor UpgradesUint8FixedLength(
 
 dm_env_rpc::v1::TensorSpec RawUnitsSpec(int max_unit_count, int num_unit_types,
                                         int num_unit_features,
-                                        int num_action_types) {
+                                        int num_action_types,
+                                        RawUnitsLayout layout) {
+  CHECK(layout != RawUnitsLayout::kFeatureMajor);
   dm_env_rpc::v1::TensorSpec spec;
   spec.set_name("raw_units");
   spec.set_dtype(dm_env_rpc::v1::DataType::INT32);
+  if (layout == RawUnitsLayout::kUnitMajorSparse) {
+    // Bounds must broadcast to the shape, which a variable number of rows
+    // can't, so sparse raw units are unbounded.
+    spec.add_shape(-1);
+    spec.add_shape(num_unit_features + 2);
+    return spec;
+  }
   spec.add_shape(max_unit_count);
   spec.add_shape(num_unit_features + 2);
 
   // All mins are 0, as that is what is populated when there is no unit.
-  for (int j = 0; j < max_unit_count; ++j) {
-    for (int i = 0; i < num_unit_features + 2; ++i) {
-      spec.mutable_min()->mutable_int32s()->add_array(0);
-    }
-  }
+  spec.mutable_min()->mutable_int32s()->mutable_array()->Resize(
+      max_unit_count * (num_unit_features + 2), 0);
 
   // We populate an array with all maxes, then broadcast that into the spec
   // taking the actual requested number of features into account.
@@ -204,257 +432,231 @@ dm_env_rpc::v1::TensorSpec RawUnitsSpec(int max_unit_count, int num_unit_types,
       3,                                // 45, shield upgrade level.
   });
 
+  auto* max_array = spec.mutable_max()->mutable_int32s()->mutable_array();
+  max_array->Reserve(max_unit_count * (num_unit_features + 2));
   for (int j = 0; j < max_unit_count; ++j) {
-    for (int i = 0; i < num_unit_features; ++i) {
-      spec.mutable_max()->mutable_int32s()->add_array(max[i]);
-    }
+    max_array->Add(max.begin(), max.begin() + num_unit_features);
     // The extra 2 features.
-    spec.mutable_max()->mutable_int32s()->add_array(1);  // unit selected.
-    spec.mutable_max()->mutable_int32s()->add_array(1);  // unit targetted.
+    max_array->Add(1);  // unit selected.
+    max_array->Add(1);  // unit targetted.
   }
   return spec;
 }
 
-dm_env_rpc::v1::Tensor RawUnitsFullVec(
+namespace {
+
+// Chunks of rows for the thread pool: about 4 per thread, so that uneven
+// chunks even out, but not so small that handing them out dominates.
+int ParallelChunkSize(int num_rows, const ThreadPool& thread_pool) {
+  constexpr int kMinChunkRows = 64;
+  const int num_chunks = 4 * thread_pool.num_threads();
+  return std::max(kMinChunkRows, (num_rows + num_chunks - 1) / num_chunks);
+}
+
+// RawUnitsToUint8 over rows [begin, end) of `columns`.
+template <int kTier>
+void MapRawUnitIdsToUint8(int begin, int end, RawUnitColumns* columns) {
+  absl::Span<int32_t> unit_type = columns->column(0);
+  absl::Span<const int32_t> display_type = columns->column(10);
+  for (int i = begin; i < end; ++i) {
+    if ((display_type[i] > 0 && unit_type[i] != kMaskedUnitTypeId) ||
+        ((kTier > 40) && columns->column(40)[i] == 1)) {
+      unit_type[i] = PySc2ToUint8(unit_type[i]);
+    }
+  }
+  if constexpr (kTier > 32) {
+    for (int j : {31, 32}) {
+      absl::Span<int32_t> buff = columns->column(j);
+      for (int i = begin; i < end; ++i) {
+        buff[i] = PySc2ToUint8Buffs(buff[i]);
+      }
+    }
+  }
+}
+
+// RawUnitsFullVec, followed by RawUnitsToUint8 if kToUint8 is set.
+template <int kTier, bool kToUint8>
+dm_env_rpc::v1::Tensor RawUnitsFullVecForTier(
     const absl::flat_hash_set<int64_t>& last_unit_tags,
     const int64_t last_target_unit_tag,
     const SC2APIProtocol::ObservationRaw& raw, int max_unit_count, bool is_raw,
     const SC2APIProtocol::Size2DI& map_size,
     const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
     int num_unit_features, bool mask_offscreen_enemies, int num_action_types,
-    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera) {
-  dm_env_rpc::v1::Tensor output =
-      ZeroMatrix<int32_t>(max_unit_count, num_unit_features + 2);
-  MutableMatrix<int32_t> m(&output);
+    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera,
+    RawUnitsLayout layout, const UnitTable* unit_table,
+    ThreadPool* thread_pool, int parallel_min_units) {
+  CHECK_EQ(UnitFeatureTier(num_unit_features), kTier);
+  // Features 0 to 29 are always written.
+  CHECK_GE(num_unit_features, 28);
+  const int num_columns = num_unit_features + 2;
+  const int unit_count = std::min(max_unit_count, raw.units_size());
 
-  absl::flat_hash_map<uint64_t, uint32_t> tag_types;
-  for (const SC2APIProtocol::Unit& u : raw.units()) {
-    tag_types[u.tag()] = u.unit_type();
+  dm_env_rpc::v1::Tensor output;
+  std::vector<int32_t> unit_major_columns;
+  absl::Span<int32_t> column_data;
+  int num_rows = max_unit_count;
+  if (layout == RawUnitsLayout::kFeatureMajor) {
+    output = ZeroMatrix<int32_t>(num_columns, max_unit_count);
+    column_data = MutableData<int32_t>(&output);
+  } else {
+    // Only the rows that get filled need to be built and transposed.
+    num_rows = std::min(
+        RawUnitsRowCount(raw, add_effects_to_units, add_cargo_to_units),
+        max_unit_count);
+    output = ZeroMatrix<int32_t>(
+        layout == RawUnitsLayout::kUnitMajorSparse ? num_rows : max_unit_count,
+        num_columns);
+    unit_major_columns.resize(num_columns * num_rows);
+    column_data = absl::MakeSpan(unit_major_columns);
   }
+  RawUnitColumns columns(column_data, num_rows);
 
-  int i = 0;
-  int unit_count = std::min(max_unit_count, raw.units_size());
-  for (; i < unit_count; i++) {
-    const SC2APIProtocol::Unit& u = raw.units(i);
-
-    SC2APIProtocol::PointI minimap =
-        WorldToMinimapPx(u.pos(), map_size, raw_resolution);
-    int minimap_pos_x = minimap.x();
-    int minimap_pos_y = minimap.y();
-    int minimap_radius =
-        WorldToMinimapDistance(u.radius(), map_size, raw_resolution);
-
-    // Match unit_vec order
-    m(i, 0) = u.unit_type();
-    m(i, 1) = u.alliance();  // Self = 1, Ally = 2, Neutral = 3, Enemy = 4
-    m(i, 2) = ToInt32(u.health());
-    m(i, 3) = ToInt32(u.shield());
-    m(i, 4) = ToInt32(u.energy());
-    m(i, 5) = u.cargo_space_taken();
-    m(i, 6) = ToInt32(static_cast<double>(u.build_progress()) * 100.0);
-
-    // Resume API order
-    if (u.health_max() > 0) {
-      m(i, 7) = ToInt32(u.health() / u.health_max() * 255.0);
-    } else {
-      m(i, 7) = 0;
+  // Add-ons are looked up by tag, so build a table if the caller has none.
+  std::optional<UnitTable> own_unit_table;
+  if constexpr (kTier > 33) {
+    if (unit_table == nullptr) {
+      unit_table = &own_unit_table.emplace(raw);
     }
-    if (u.shield_max() > 0) {
-      m(i, 8) = ToInt32(u.shield() / u.shield_max() * 255.0);
-    } else {
-      m(i, 8) = 0;
-    }
-    if (u.energy_max() > 0) {
-      m(i, 9) = ToInt32(u.energy() / u.energy_max() * 255.0);
-    } else {
-      m(i, 9) = 0;
-    }
-    m(i, 10) = u.display_type();  // Visible = 1; Snapshot = 2; Hidden = 3
-    m(i, 11) = u.owner();         //  1 - 15;    16 = neutral
-    m(i, 12) = minimap_pos_x;
-    m(i, 13) = minimap_pos_y;
-    m(i, 14) = ToInt32(u.facing());
-    m(i, 15) = minimap_radius;
-    m(i, 16) = u.cloak();  // Cloaked = 1; CloakedDetected = 2; NotCloaked = 3
-    m(i, 17) = u.is_selected();
-    m(i, 18) = u.is_blip();
-    m(i, 19) = u.is_powered();
-    m(i, 20) = u.mineral_contents();
-    m(i, 21) = u.vespene_contents();
-
-    // Not populated for enemies or neutral
-    m(i, 22) = u.cargo_space_max();
-    m(i, 23) = u.assigned_harvesters();
-    m(i, 24) = u.ideal_harvesters();
-    m(i, 25) = ToInt32(u.weapon_cooldown());
-    m(i, 26) = u.orders_size();
-    if (u.orders_size() > 0) {
-      m(i, 27) = GeneralOrderId(RawAbilityToGameId(u.orders(0).ability_id()),
-                                num_action_types);
-    } else {
-      m(i, 27) = 0;
-    }
-    if (u.orders_size() > 1) {
-      m(i, 28) = GeneralOrderId(RawAbilityToGameId(u.orders(1).ability_id()),
-                                num_action_types);
-    } else {
-      m(i, 28) = 0;
-    }
-    if (is_raw) {
-      m(i, 29) = u.tag();
+  }
+  RawUnitFields fields(unit_count);
+  // Runs fn(begin, end) over [0, size), on the thread pool if the frame has
+  // enough units to make up for handing the work out.
+  const bool parallel =
+      thread_pool != nullptr && unit_count >= parallel_min_units;
+  auto run_rows = [&](int size, const std::function<void(int, int)>& fn) {
+    if (parallel) {
+      thread_pool->ParallelFor(size, ParallelChunkSize(size, *thread_pool),
+                               fn);
     } else {
-      m(i, 29) = 0;
+      fn(0, size);
     }
-
-    if (num_unit_features > 33) {
-      m(i, 30) = u.is_hallucination();
-      if (u.buff_ids_size() >= 1) {
-        m(i, 31) = u.buff_ids(0);
-      } else {
-        m(i, 31) = 0;
-      }
-      if (u.buff_ids_size() >= 2) {
-        m(i, 32) = u.buff_ids(1);
-      } else {
-        m(i, 32) = 0;
-      }
-      if (u.has_add_on_tag()) {
-        const auto it = tag_types.find(u.add_on_tag());
-        if (it != tag_types.end()) {
-          m(i, 33) = it->second;
-        } else {
-          m(i, 33) = 0;
+  };
+
+  // Everything up to the cargo and effects is done per unit, so it can be
+  // split into ranges of units, each of which writes just its own rows.
+  auto convert_units = [&](int begin, int end) {
+    GatherRawUnitFields<kTier>(raw, begin, end, is_raw, unit_table, &fields,
+                               &columns);
+    ConvertRawUnitFields(fields, begin, end, &columns);
+    MinimapPositions(fields, begin, end, map_size, raw_resolution, &columns);
+
+    auto order_ids = [&](int k, int j) {
+      absl::Span<int32_t> col = columns.column(j);
+      for (int i = begin; i < end; ++i) {
+        if (fields.order_counts[i] > k) {
+          col[i] = GeneralOrderId(RawAbilityToGameId(fields.ability_ids[k][i]),
+                                  num_action_types);
         }
-      } else {
-        m(i, 33) = 0;
       }
-    }
-
-    if (num_unit_features > 34) {
-      m(i, 34) = u.is_active();
-    }
+    };
+    order_ids(0, 27);
+    order_ids(1, 28);
 
-    bool is_on_screen = false;
+    std::vector<uint8_t>& is_on_screen = fields.is_on_screen;
     if (camera) {
-      is_on_screen = camera->IsOnScreen(u.pos().x(), u.pos().y());
-    } else {
-      is_on_screen = u.is_on_screen();
-    }
-
-    if (num_unit_features > 35) {
-      m(i, 35) = is_on_screen;
-    }
-
-    if (num_unit_features > 39) {
-      if (u.orders_size() >= 1) {
-        m(i, 36) = ToInt32(static_cast<double>(u.orders(0).progress()) * 100.0);
-      }
-      if (u.orders_size() >= 2) {
-        m(i, 37) = ToInt32(static_cast<double>(u.orders(1).progress()) * 100.0);
-      }
-      if (u.orders_size() > 2) {
-        m(i, 38) = GeneralOrderId(RawAbilityToGameId(u.orders(2).ability_id()),
-                                  num_action_types);
-      } else {
-        m(i, 38) = 0;
-      }
-      if (u.orders_size() > 3) {
-        m(i, 39) = GeneralOrderId(RawAbilityToGameId(u.orders(3).ability_id()),
-                                  num_action_types);
-      } else {
-        m(i, 39) = 0;
+      for (int i = begin; i < end; ++i) {
+        is_on_screen[i] = camera->IsOnScreen(fields.x[i], fields.y[i]);
       }
     }
-
-    if (num_unit_features > 45) {
-      m(i, 41) = u.buff_duration_remain();
-      m(i, 42) = u.buff_duration_max();
-      m(i, 43) = u.attack_upgrade_level();
-      m(i, 44) = u.armor_upgrade_level();
-      m(i, 45) = u.shield_upgrade_level();
+    if constexpr (kTier > 35) {
+      std::copy(is_on_screen.begin() + begin, is_on_screen.begin() + end,
+                columns.column(35).begin() + begin);
     }
 
-    if (last_unit_tags.find(u.tag()) != last_unit_tags.end()) {
-      m(i, num_unit_features) = 1;
-    } else {
-      m(i, num_unit_features) = 0;
-    }
-    if (last_target_unit_tag == u.tag()) {
-      m(i, num_unit_features + 1) = 1;
-    } else {
-      m(i, num_unit_features + 1) = 0;
-    }
-
-    bool mask_enemy = mask_offscreen_enemies &&
-                      u.alliance() == SC2APIProtocol::Enemy && !is_on_screen;
-    if (mask_enemy && u.cloak() == SC2APIProtocol::Cloaked) {
-      for (int j = 0; j < num_unit_features + 2; j++) {
-        m(i, j) = 0;
-      }
-      if (is_raw) {
-        // Unit tag should not be used directly by the agent, but is used for
-        // various things like masking.
-        m(i, 29) = u.tag();
+    if constexpr (kTier > 39) {
+      for (int k = 0; k < 2; ++k) {
+        absl::Span<int32_t> progress = columns.column(36 + k);
+        for (int i = begin; i < end; ++i) {
+          if (fields.order_counts[i] > k) {
+            progress[i] = ToInt32(
+                static_cast<double>(fields.order_progress[k][i]) * 100.0);
+          }
+        }
       }
+      order_ids(2, 38);
+      order_ids(3, 39);
     }
 
-    if (mask_enemy && u.display_type() == SC2APIProtocol::Visible) {
-      // Mask out features that should not be visible by camera agents outside
-      // of the camera.
-      m(i, 0) = kMaskedUnitTypeId;  // unit_type.
+    absl::Span<int32_t> selected = columns.column(num_unit_features);
+    absl::Span<int32_t> targeted = columns.column(num_unit_features + 1);
+    for (int i = begin; i < end; ++i) {
+      selected[i] = last_unit_tags.contains(fields.tags[i]);
+      targeted[i] = last_target_unit_tag == fields.tags[i];
+    }
 
-      for (auto f : kUnitFeaturesToMask) {
-        if (f < num_unit_features + 2) {
-          m(i, f) = 0;
+    if (mask_offscreen_enemies) {
+      for (int i = begin; i < end; ++i) {
+        int alliance = columns.column(1)[i];
+        int display_type = columns.column(10)[i];
+        int cloak = columns.column(16)[i];
+        if (alliance != SC2APIProtocol::Enemy || is_on_screen[i]) {
+          continue;
+        }
+        if (cloak == SC2APIProtocol::Cloaked) {
+          int32_t tag = columns.column(29)[i];
+          columns.ZeroRow(i);
+          // Unit tag should not be used directly by the agent, but is used for
+          // various things like masking.
+          columns.column(29)[i] = tag;
+        }
+        if (display_type == SC2APIProtocol::Visible) {
+          // Mask out features that should not be visible by camera agents
+          // outside of the camera.
+          columns.column(0)[i] = kMaskedUnitTypeId;  // unit_type.
+
+          for (auto f : kUnitFeaturesToMask) {
+            if (f < num_columns) {
+              columns.column(f)[i] = 0;
+            }
+          }
+
+          CHECK_LE(num_unit_features, 46)
+              << "You need to update the list of masked unit features.";
         }
       }
-
-      CHECK_LE(num_unit_features, 46)
-          << "You need to update the list of masked unit features.";
     }
-  }
 
+  };
+  run_rows(unit_count, convert_units);
+  int i = unit_count;
+  // World positions of the cargo and effect rows, converted to minimap pixels
+  // together once they are all known.
+  std::vector<float> extra_x;
+  std::vector<float> extra_y;
   if (add_cargo_to_units) {
     // Add cargo at the end, treat them as units for now.
     for (const SC2APIProtocol::Unit& u : raw.units()) {
-      SC2APIProtocol::PointI minimap_pos =
-          WorldToMinimapPx(u.pos(), map_size, raw_resolution);
-      int minimap_pos_x = minimap_pos.x();
-      int minimap_pos_y = minimap_pos.y();
-
+      if (u.passengers().empty()) {
+        continue;
+      }
       for (const SC2APIProtocol::PassengerUnit& p : u.passengers()) {
         if (i >= max_unit_count) {
           break;
         }
 
-        m(i, 0) = p.unit_type();
-        m(i, 1) = u.alliance();
-        m(i, 2) = ToInt32(p.health());
-        m(i, 3) = ToInt32(p.shield());
-        m(i, 4) = ToInt32(p.energy());
+        columns.column(0)[i] = p.unit_type();
+        columns.column(1)[i] = u.alliance();
+        columns.column(2)[i] = ToInt32(p.health());
+        columns.column(3)[i] = ToInt32(p.shield());
+        columns.column(4)[i] = ToInt32(p.energy());
         if (p.health_max() > 0) {
-          m(i, 7) = ToInt32(p.health() / p.health_max() * 255.0);
-        } else {
-          m(i, 7) = 0;
+          columns.column(7)[i] = ToInt32(p.health() / p.health_max() * 255.0);
         }
         if (p.shield_max() > 0) {
-          m(i, 8) = ToInt32(p.shield() / p.shield_max() * 255.0);
-        } else {
-          m(i, 8) = 0;
+          columns.column(8)[i] = ToInt32(p.shield() / p.shield_max() * 255.0);
         }
         if (p.energy_max() > 0) {
-          m(i, 9) = ToInt32(p.energy() / p.energy_max() * 255.0);
-        } else {
-          m(i, 9) = 0;
+          columns.column(9)[i] = ToInt32(p.energy() / p.energy_max() * 255.0);
         }
-        m(i, 11) = u.owner();
-        m(i, 12) = minimap_pos_x;
-        m(i, 13) = minimap_pos_y;
+        columns.column(11)[i] = u.owner();
+        extra_x.push_back(u.pos().x());
+        extra_y.push_back(u.pos().y());
         if (is_raw) {
-          m(i, 29) = p.tag();
+          columns.column(29)[i] = p.tag();
         }
-        if (40 < num_unit_features + 2) {
-          m(i, 40) = 1;  // In cargo
+        if constexpr (40 < kTier + 2) {
+          columns.column(40)[i] = 1;  // In cargo
         }
 
         i++;
@@ -473,46 +675,243 @@ dm_env_rpc::v1::Tensor RawUnitsFullVec(
           break;
         }
 
-        SC2APIProtocol::PointI minimap_pos =
-            WorldToMinimapPx(pos, map_size, raw_resolution);
-        int minimap_pos_x = minimap_pos.x();
-        int minimap_pos_y = minimap_pos.y();
-
         // int minimap_radius =
         //     WorldToMinimapDistance(e.radius(), map_size, raw_resolution);
 
-        m(i, 0) = e.effect_id() + num_unit_types;
-        m(i, 1) = e.alliance();
-        m(i, 11) = e.owner();
-        m(i, 12) = minimap_pos_x;
-        m(i, 13) = minimap_pos_y;
+        columns.column(0)[i] = e.effect_id() + num_unit_types;
+        columns.column(1)[i] = e.alliance();
+        columns.column(11)[i] = e.owner();
+        extra_x.push_back(pos.x());
+        extra_y.push_back(pos.y());
         // TODO(petkoig): Transform radius when sc2_env changes.
-        m(i, 15) = ToInt32(e.radius());
+        columns.column(15)[i] = ToInt32(e.radius());
 
         i++;
       }
     }
   }
-
+  WorldToMinimapPx(extra_x, extra_y, map_size, raw_resolution,
+                   columns.column(12).subspan(unit_count, i - unit_count),
+                   columns.column(13).subspan(unit_count, i - unit_count));
+
+  // Rows past `i` are all zeros, which the mapping leaves as they are, and
+  // which are already in place in the feature major layout.
+  const int num_filled_rows = i;
+  const bool transpose = layout != RawUnitsLayout::kFeatureMajor;
+  std::vector<const int32_t*> column_ptrs(num_columns);
+  for (int j = 0; j < num_columns; ++j) {
+    column_ptrs[j] = columns.column(j).data();
+  }
+  absl::Span<int32_t> out = MutableData<int32_t>(&output);
+  auto finish_rows = [&](int begin, int end) {
+    if constexpr (kToUint8) {
+      MapRawUnitIdsToUint8<kTier>(begin, std::min(end, num_filled_rows),
+                                  &columns);
+    }
+    if (transpose) {
+      // Transposed a block of rows at a time, so that each column is read
+      // sequentially.
+      constexpr int kBlock = 16;
+      for (int block = begin; block < end; block += kBlock) {
+        int block_end = std::min(block + kBlock, end);
+        for (int j = 0; j < num_columns; ++j) {
+          const int32_t* column = column_ptrs[j];
+          for (int row = block; row < block_end; ++row) {
+            out[row * num_columns + j] = column[row];
+          }
+        }
+      }
+    }
+  };
+  run_rows(transpose ? num_rows : num_filled_rows, finish_rows);
   return output;
 }
 
-dm_env_rpc::v1::Tensor RawUnitsToUint8(const dm_env_rpc::v1::Tensor& tensor,
-                                       int num_unit_features) {
+template <int kTier>
+dm_env_rpc::v1::Tensor RawUnitsToUint8ForTier(
+    const dm_env_rpc::v1::Tensor& tensor, int num_unit_features) {
+  CHECK_EQ(UnitFeatureTier(num_unit_features), kTier);
   dm_env_rpc::v1::Tensor output = tensor;
   MutableMatrix<int32_t> o(&output);
 
   for (int i = 0; i < o.height(); i++) {
-    if ((o(i, 10) > 0 && o(i, 0) != kMaskedUnitTypeId) ||
-        ((num_unit_features > 40) && o(i, 40) == 1)) {
+    absl::Span<int32_t> row = o.row(i);
+    if ((row[10] > 0 && row[0] != kMaskedUnitTypeId) ||
+        ((kTier > 40) && row[40] == 1)) {
       // This is a unit type as it has a display type or is in cargo.
       // We do not convert effect ids or uncheat unit types.
-      o(i, 0) = PySc2ToUint8(o(i, 0));
+      row[0] = PySc2ToUint8(row[0]);
     }
-    if (num_unit_features > 32) {
+    if constexpr (kTier > 32) {
       // Buffs are added in unit features observation.
-      o(i, 31) = PySc2ToUint8Buffs(o(i, 31));
-      o(i, 32) = PySc2ToUint8Buffs(o(i, 32));
+      row[31] = PySc2ToUint8Buffs(row[31]);
+      row[32] = PySc2ToUint8Buffs(row[32]);
+    }
+  }
+  return output;
+}
+
+template <int kTier>
+RawUnitsFunctions RawUnitsFunctionsForTier() {
+  return {&RawUnitsFullVecForTier<kTier, false>,
+          &RawUnitsFullVecForTier<kTier, true>,
+          &RawUnitsToUint8ForTier<kTier>};
+}
+
+}  // namespace
+
+void RawUnitsDelta(const dm_env_rpc::v1::Tensor& raw_units,
+                   std::vector<int32_t>* previous,
+                   dm_env_rpc::v1::Tensor* rows,
+                   dm_env_rpc::v1::Tensor* values) {
+  CHECK_EQ(raw_units.shape_size(), 2);
+  const int num_rows = raw_units.shape(0);
+  const int width = raw_units.shape(1);
+  absl::Span<const int32_t> data = Data<int32_t>(raw_units);
+  const bool keyframe = previous->size() != data.size();
+
+  std::vector<int> changed;
+  for (int i = 0; i < num_rows; ++i) {
+    auto row = data.begin() + i * width;
+    if (keyframe ||
+        !std::equal(row, row + width, previous->begin() + i * width)) {
+      changed.push_back(i);
+    }
+  }
+
+  *rows = ZeroVector<int32_t>(changed.size());
+  *values = ZeroMatrix<int32_t>(changed.size(), width);
+  absl::Span<int32_t> row_data = MutableData<int32_t>(rows);
+  absl::Span<int32_t> value_data = MutableData<int32_t>(values);
+  for (int k = 0; k < changed.size(); ++k) {
+    row_data[k] = changed[k];
+    std::copy_n(data.begin() + changed[k] * width, width,
+                value_data.begin() + k * width);
+  }
+  previous->assign(data.begin(), data.end());
+}
+
+int UnitFeatureTier(int num_unit_features) {
+  for (int tier : {46, 41, 40, 39, 36, 35, 34, 33}) {
+    if (num_unit_features >= tier) {
+      return tier;
+    }
+  }
+  return 0;
+}
+
+RawUnitsFunctions RawUnitsFunctionsFor(int num_unit_features) {
+  switch (UnitFeatureTier(num_unit_features)) {
+    case 46:
+      return RawUnitsFunctionsForTier<46>();
+    case 41:
+      return RawUnitsFunctionsForTier<41>();
+    case 40:
+      return RawUnitsFunctionsForTier<40>();
+    case 39:
+      return RawUnitsFunctionsForTier<39>();
+    case 36:
+      return RawUnitsFunctionsForTier<36>();
+    case 35:
+      return RawUnitsFunctionsForTier<35>();
+    case 34:
+      return RawUnitsFunctionsForTier<34>();
+    case 33:
+      return RawUnitsFunctionsForTier<33>();
+    default:
+      return RawUnitsFunctionsForTier<0>();
+  }
+}
+
+dm_env_rpc::v1::Tensor RawUnitsFullVec(
+    const absl::flat_hash_set<int64_t>& last_unit_tags,
+    const int64_t last_target_unit_tag,
+    const SC2APIProtocol::ObservationRaw& raw, int max_unit_count, bool is_raw,
+    const SC2APIProtocol::Size2DI& map_size,
+    const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
+    int num_unit_features, bool mask_offscreen_enemies, int num_action_types,
+    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera,
+    RawUnitsLayout layout, const UnitTable* unit_table,
+    ThreadPool* thread_pool, int parallel_min_units) {
+  return RawUnitsFunctionsFor(num_unit_features)
+      .full_vec(last_unit_tags, last_target_unit_tag, raw, max_unit_count,
+                is_raw, map_size, raw_resolution, num_unit_types,
+                num_unit_features, mask_offscreen_enemies, num_action_types,
+                add_effects_to_units, add_cargo_to_units, camera, layout,
+                unit_table, thread_pool, parallel_min_units);
+}
+
+dm_env_rpc::v1::Tensor RawUnitsFullVecUint8(
+    const absl::flat_hash_set<int64_t>& last_unit_tags,
+    const int64_t last_target_unit_tag,
+    const SC2APIProtocol::ObservationRaw& raw, int max_unit_count, bool is_raw,
+    const SC2APIProtocol::Size2DI& map_size,
+    const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
+    int num_unit_features, bool mask_offscreen_enemies, int num_action_types,
+    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera,
+    RawUnitsLayout layout, const UnitTable* unit_table,
+    ThreadPool* thread_pool, int parallel_min_units) {
+  return RawUnitsFunctionsFor(num_unit_features)
+      .full_vec_uint8(last_unit_tags, last_target_unit_tag, raw,
+                      max_unit_count, is_raw, map_size, raw_resolution,
+                      num_unit_types, num_unit_features,
+                      mask_offscreen_enemies, num_action_types,
+                      add_effects_to_units, add_cargo_to_units, camera, layout,
+                      unit_table, thread_pool, parallel_min_units);
+}
+
+dm_env_rpc::v1::Tensor RawUnitsToUint8(const dm_env_rpc::v1::Tensor& tensor,
+                                       int num_unit_features) {
+  return RawUnitsFunctionsFor(num_unit_features)
+      .to_uint8(tensor, num_unit_features);
+}
+
+int RawUnitsRowCount(const SC2APIProtocol::ObservationRaw& raw,
+                     bool add_effects_to_units, bool add_cargo_to_units) {
+  int num_rows = raw.units_size();
+  if (add_cargo_to_units) {
+    for (const SC2APIProtocol::Unit& u : raw.units()) {
+      num_rows += u.passengers_size();
+    }
+  }
+  if (add_effects_to_units) {
+    for (const SC2APIProtocol::Effect& e : raw.effects()) {
+      num_rows += e.pos_size();
+    }
+  }
+  return num_rows;
+}
+
+dm_env_rpc::v1::Tensor RawUnitsToSlots(
+    const dm_env_rpc::v1::Tensor& feature_major,
+    absl::Span<const int> unit_slots, int max_unit_count,
+    dm_env_rpc::v1::Tensor* valid) {
+  CHECK_EQ(feature_major.shape_size(), 2);
+  const int num_columns = feature_major.shape(0);
+  const int num_rows = feature_major.shape(1);
+  absl::Span<const int32_t> columns = Data<int32_t>(feature_major);
+  CHECK_EQ(unit_slots.size(), num_rows);
+
+  // The row of feature_major which goes to each slot, or -1.
+  std::vector<int> slot_rows(max_unit_count, -1);
+  for (int i = 0; i < unit_slots.size(); ++i) {
+    if (unit_slots[i] >= 0) {
+      CHECK_LT(unit_slots[i], max_unit_count);
+      slot_rows[unit_slots[i]] = i;
+    }
+  }
+
+  dm_env_rpc::v1::Tensor output =
+      ZeroMatrix<int32_t>(max_unit_count, num_columns);
+  absl::Span<int32_t> rows = MutableData<int32_t>(&output);
+  *valid = ZeroVector<int32_t>(max_unit_count);
+  absl::Span<int32_t> valid_data = MutableData<int32_t>(valid);
+  for (int s = 0; s < max_unit_count; ++s) {
+    if (const int i = slot_rows[s]; i >= 0) {
+      for (int j = 0; j < num_columns; ++j) {
+        rows[s * num_columns + j] = columns[j * num_rows + i];
+      }
+      valid_data[s] = 1;
     }
   }
   return output;
@@ -560,14 +959,9 @@ dm_env_rpc::v1::Tensor SeparateCamera(
     const dm_env_rpc::v1::Tensor& camera_position,
     const dm_env_rpc::v1::Tensor& camera_size,
     const SC2APIProtocol::Size2DI& raw_resolution) {
-  dm_env_rpc::v1::Tensor output;
-  output.add_shape(raw_resolution.y());
-  output.add_shape(raw_resolution.x());
-
-  const auto size = raw_resolution.y() * raw_resolution.x();
-  for (int i = 0; i < size; ++i) {
-    output.mutable_int32s()->add_array(0);
-  }
+  dm_env_rpc::v1::Tensor output =
+      ZeroMatrix<int32_t>(raw_resolution.y(), raw_resolution.x());
+  absl::Span<int32_t> data = MutableData<int32_t>(&output);
 
   auto px = camera_position.int32s().array(0);
   auto py = camera_position.int32s().array(1);
@@ -580,7 +974,7 @@ dm_env_rpc::v1::Tensor SeparateCamera(
 
   for (int j = y_lower; j < y_upper; j++) {
     for (int i = x_lower; i < x_upper; i++) {
-      output.mutable_int32s()->set_array(j * raw_resolution.x() + i, 1);
+      data[j * raw_resolution.x() + i] = 1;
     }
   }
 
@@ -646,4 +1040,109 @@ dm_env_rpc::v1::Tensor AddUnitCountsBowData(
   return output;
 }
 
+bool FeatureLayerCache::Lookup(const SC2APIProtocol::ImageData& layer,
+                               absl::Span<uint8_t> output) const {
+  if (!valid_ || output.size() != decoded_.size() ||
+      layer.bits_per_pixel() != layer_.bits_per_pixel() ||
+      layer.size().x() != layer_.size().x() ||
+      layer.size().y() != layer_.size().y() || layer.data() != layer_.data()) {
+    return false;
+  }
+  std::copy(decoded_.begin(), decoded_.end(), output.begin());
+  return true;
+}
+
+void FeatureLayerCache::Store(const SC2APIProtocol::ImageData& layer,
+                              absl::Span<const uint8_t> decoded) {
+  layer_ = layer;
+  decoded_.assign(decoded.begin(), decoded.end());
+  valid_ = true;
+}
+
+namespace {
+
+template <typename T>
+using FeatureLayerGetter = const SC2APIProtocol::ImageData& (T::*)() const;
+
+template <typename T>
+std::vector<FeatureLayerAccessor<T>> MakeFeatureLayerAccessors(
+    const absl::flat_hash_map<std::string, FeatureLayerGetter<T>>& getters,
+    const std::vector<std::string>& layer_names) {
+  CHECK(!layer_names.empty());
+  std::vector<FeatureLayerAccessor<T>> accessors;
+  for (const std::string& layer_name : layer_names) {
+    auto it = getters.find(layer_name);
+    CHECK(it != getters.end()) << "Could not find " << layer_name << " in "
+                               << T::descriptor()->full_name();
+    FeatureLayerAccessor<T> accessor{it->second, {}, nullptr};
+    if (layer_name == "unit_type") {
+      accessor.table = PySc2ToUint8Table();
+    } else if (layer_name == "buffs") {
+      accessor.table = PySc2ToUint8BuffsTable();
+    }
+    accessors.push_back(accessor);
+  }
+  return accessors;
+}
+
+}  // namespace
+
+template <>
+std::vector<FeatureLayerAccessor<SC2APIProtocol::FeatureLayers>>
+FeatureLayerAccessors(const std::vector<std::string>& layer_names) {
+  using Layers = SC2APIProtocol::FeatureLayers;
+  static const auto* getters =
+      new absl::flat_hash_map<std::string, FeatureLayerGetter<Layers>>({
+          {"height_map", &Layers::height_map},
+          {"visibility_map", &Layers::visibility_map},
+          {"creep", &Layers::creep},
+          {"power", &Layers::power},
+          {"player_id", &Layers::player_id},
+          {"unit_type", &Layers::unit_type},
+          {"selected", &Layers::selected},
+          {"unit_hit_points", &Layers::unit_hit_points},
+          {"unit_hit_points_ratio", &Layers::unit_hit_points_ratio},
+          {"unit_energy", &Layers::unit_energy},
+          {"unit_energy_ratio", &Layers::unit_energy_ratio},
+          {"unit_shields", &Layers::unit_shields},
+          {"unit_shields_ratio", &Layers::unit_shields_ratio},
+          {"player_relative", &Layers::player_relative},
+          {"unit_density_aa", &Layers::unit_density_aa},
+          {"unit_density", &Layers::unit_density},
+          {"effects", &Layers::effects},
+          {"hallucinations", &Layers::hallucinations},
+          {"cloaked", &Layers::cloaked},
+          {"blip", &Layers::blip},
+          {"buffs", &Layers::buffs},
+          {"buff_duration", &Layers::buff_duration},
+          {"active", &Layers::active},
+          {"build_progress", &Layers::build_progress},
+          {"buildable", &Layers::buildable},
+          {"pathable", &Layers::pathable},
+          {"placeholder", &Layers::placeholder},
+      });
+  return MakeFeatureLayerAccessors(*getters, layer_names);
+}
+
+template <>
+std::vector<FeatureLayerAccessor<SC2APIProtocol::FeatureLayersMinimap>>
+FeatureLayerAccessors(const std::vector<std::string>& layer_names) {
+  using Layers = SC2APIProtocol::FeatureLayersMinimap;
+  static const auto* getters =
+      new absl::flat_hash_map<std::string, FeatureLayerGetter<Layers>>({
+          {"height_map", &Layers::height_map},
+          {"visibility_map", &Layers::visibility_map},
+          {"creep", &Layers::creep},
+          {"camera", &Layers::camera},
+          {"player_id", &Layers::player_id},
+          {"player_relative", &Layers::player_relative},
+          {"selected", &Layers::selected},
+          {"alerts", &Layers::alerts},
+          {"buildable", &Layers::buildable},
+          {"pathable", &Layers::pathable},
+          {"unit_type", &Layers::unit_type},
+      });
+  return MakeFeatureLayerAccessors(*getters, layer_names);
+}
+
 }  // namespace pysc2
@@ -16,17 +16,21 @@
 #define PYSC2_ENV_CONVERTER_CC_CONVERT_OBS_H_
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "glog/logging.h"
 #include "google/protobuf/repeated_field.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/cc/encode_image_data.h"
 #include "pysc2/env/converter/cc/game_data/uint8_lookup.h"
 #include "pysc2/env/converter/cc/raw_camera.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/thread_pool.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "s2clientprotocol/common.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
 
@@ -41,10 +45,21 @@ dm_env_rpc::v1::Tensor Upgrades(const SC2APIProtocol::Observation& obs);
 dm_env_rpc::v1::Tensor UpgradesUint8FixedLength(
     const dm_env_rpc::v1::Tensor& upgrades, int max_num_upgrades);
 
-dm_env_rpc::v1::TensorSpec RawUnitsSpec(int max_unit_count, int num_unit_types,
-                                        int num_unit_features,
-                                        int num_action_types);
+// Memory order of the raw units matrix. kFeatureMajor returns it transposed,
+// as [num_unit_features + 2, max_unit_count], which is how it is built.
+// kUnitMajorSparse leaves out the zero padding, returning just the filled
+// [num_units, num_unit_features + 2] rows.
+enum class RawUnitsLayout { kUnitMajor, kFeatureMajor, kUnitMajorSparse };
 
+// The spec of raw units in the kUnitMajor or kUnitMajorSparse layout. The
+// latter has a variable number of rows and no bounds; each row is bounded as
+// a row of the kUnitMajor spec.
+dm_env_rpc::v1::TensorSpec RawUnitsSpec(
+    int max_unit_count, int num_unit_types, int num_unit_features,
+    int num_action_types, RawUnitsLayout layout = RawUnitsLayout::kUnitMajor);
+
+// With a `thread_pool`, frames of at least `parallel_min_units` units are
+// converted a range of units per thread. The result is the same either way.
 dm_env_rpc::v1::Tensor RawUnitsFullVec(
     const absl::flat_hash_set<int64_t>& last_unit_tags,
     const int64_t last_target_unit_tag,
@@ -52,11 +67,83 @@ dm_env_rpc::v1::Tensor RawUnitsFullVec(
     const SC2APIProtocol::Size2DI& map_size,
     const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
     int num_unit_features, bool mask_offscreen_enemies, int num_action_types,
-    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera);
+    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera,
+    RawUnitsLayout layout = RawUnitsLayout::kUnitMajor,
+    const UnitTable* unit_table = nullptr, ThreadPool* thread_pool = nullptr,
+    int parallel_min_units = 0);
 
 dm_env_rpc::v1::Tensor RawUnitsToUint8(const dm_env_rpc::v1::Tensor& tensor,
                                        int num_unit_features);
 
+// The same as RawUnitsToUint8(RawUnitsFullVec(...)), with the ids mapped
+// while the matrix is built rather than in a copy of it.
+dm_env_rpc::v1::Tensor RawUnitsFullVecUint8(
+    const absl::flat_hash_set<int64_t>& last_unit_tags,
+    const int64_t last_target_unit_tag,
+    const SC2APIProtocol::ObservationRaw& raw, int max_unit_count, bool is_raw,
+    const SC2APIProtocol::Size2DI& map_size,
+    const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
+    int num_unit_features, bool mask_offscreen_enemies, int num_action_types,
+    bool add_effects_to_units, bool add_cargo_to_units, RawCamera* camera,
+    RawUnitsLayout layout = RawUnitsLayout::kUnitMajor,
+    const UnitTable* unit_table = nullptr, ThreadPool* thread_pool = nullptr,
+    int parallel_min_units = 0);
+
+// The number of rows RawUnitsFullVec fills if max_unit_count doesn't cut it
+// short: one per unit, plus the passengers and effect positions if added.
+int RawUnitsRowCount(const SC2APIProtocol::ObservationRaw& raw,
+                     bool add_effects_to_units, bool add_cargo_to_units);
+
+// Moves raw units built in RawUnitsLayout::kFeatureMajor, with one row per
+// unit and no passengers or effects, into stable slots. Unit i goes to row
+// unit_slots[i] (see UnitTable::unit_slots) and is dropped without a slot.
+// Returns a [max_unit_count, num_unit_features + 2] matrix and sets `valid`
+// to whether each of its rows is filled.
+dm_env_rpc::v1::Tensor RawUnitsToSlots(
+    const dm_env_rpc::v1::Tensor& feature_major,
+    absl::Span<const int> unit_slots, int max_unit_count,
+    dm_env_rpc::v1::Tensor* valid);
+
+// Sets `rows` and `values` to the indices and contents of the rows of
+// `raw_units` which differ from `previous`, then updates `previous` to
+// raw_units. If `previous` doesn't hold a matrix of the same size, such as
+// when it is empty, every row counts as changed.
+void RawUnitsDelta(const dm_env_rpc::v1::Tensor& raw_units,
+                   std::vector<int32_t>* previous,
+                   dm_env_rpc::v1::Tensor* rows,
+                   dm_env_rpc::v1::Tensor* values);
+
+// RawUnitsFullVec and RawUnitsToUint8 add features at fixed feature counts.
+// Returns the largest of those counts not above `num_unit_features`, which
+// is the tier the functions below are specialized on.
+int UnitFeatureTier(int num_unit_features);
+
+// RawUnitsFullVec, RawUnitsFullVecUint8 and RawUnitsToUint8 compiled for the
+// feature tier of `num_unit_features`, so that the per-unit feature count
+// checks are resolved at compile time. The returned functions must only be
+// called with a `num_unit_features` of the same tier. As the tier is fixed for
+// the lifetime of a converter, look these up once rather than per
+// observation.
+struct RawUnitsFunctions {
+  using FullVec = dm_env_rpc::v1::Tensor (*)(
+      const absl::flat_hash_set<int64_t>& last_unit_tags,
+      const int64_t last_target_unit_tag,
+      const SC2APIProtocol::ObservationRaw& raw, int max_unit_count,
+      bool is_raw, const SC2APIProtocol::Size2DI& map_size,
+      const SC2APIProtocol::Size2DI& raw_resolution, int num_unit_types,
+      int num_unit_features, bool mask_offscreen_enemies,
+      int num_action_types, bool add_effects_to_units, bool add_cargo_to_units,
+      RawCamera* camera, RawUnitsLayout layout, const UnitTable* unit_table,
+      ThreadPool* thread_pool, int parallel_min_units);
+
+  FullVec full_vec;
+  FullVec full_vec_uint8;
+  dm_env_rpc::v1::Tensor (*to_uint8)(const dm_env_rpc::v1::Tensor& tensor,
+                                     int num_unit_features);
+};
+
+RawUnitsFunctions RawUnitsFunctionsFor(int num_unit_features);
+
 dm_env_rpc::v1::Tensor CameraPosition(
     const SC2APIProtocol::Observation& obs,
     const SC2APIProtocol::Size2DI& map_size,
@@ -116,9 +203,65 @@ std::vector<int> FeatureLayerFieldIndices(
   return field_indices;
 }
 
+// The last decoding of a feature layer. Used for layers which rarely change
+// within an episode, such as the height map, so that they are only decoded
+// again when their bytes change.
+class FeatureLayerCache {
+ public:
+  // Copies the stored decoding to `output` and returns true if `layer` is
+  // the one it was decoded from, otherwise returns false.
+  bool Lookup(const SC2APIProtocol::ImageData& layer,
+              absl::Span<uint8_t> output) const;
+
+  void Store(const SC2APIProtocol::ImageData& layer,
+             absl::Span<const uint8_t> decoded);
+
+ private:
+  bool valid_ = false;
+  SC2APIProtocol::ImageData layer_;
+  std::vector<uint8_t> decoded_;
+};
+
+// A feature layer of a FeatureLayers or FeatureLayersMinimap message,
+// resolved ahead of time so that it can be decoded without reflection.
 template <typename T>
-dm_env_rpc::v1::Tensor FeatureLayer8bit(const T& layers, int layer_index,
-                                        const std::string& layer_name) {
+struct FeatureLayerAccessor {
+  // The generated getter for the layer.
+  const SC2APIProtocol::ImageData& (T::*layer)() const;
+  // Lookup table the layer's values are mapped through, or empty if they
+  // are used as they are.
+  absl::Span<const uint8_t> table;
+  // If set, decodings of the layer are reused while its bytes are unchanged.
+  std::shared_ptr<FeatureLayerCache> cache;
+};
+
+// Accessors for the named layers, in order. Dies if a layer is not a field
+// of T.
+template <typename T>
+std::vector<FeatureLayerAccessor<T>> FeatureLayerAccessors(
+    const std::vector<std::string>& layer_names);
+
+// Decodes a layer into `output`, which must be the size of the layer.
+template <typename T>
+void FeatureLayer8bit(const T& layers, const FeatureLayerAccessor<T>& accessor,
+                      absl::Span<uint8_t> output) {
+  const SC2APIProtocol::ImageData& layer = (layers.*accessor.layer)();
+  if (accessor.cache && accessor.cache->Lookup(layer, output)) {
+    return;
+  }
+  if (accessor.table.empty()) {
+    EncodeImageData<uint8_t>(layer, nullptr, output);
+  } else {
+    EncodeImageData<uint8_t>(layer, accessor.table, output);
+  }
+  if (accessor.cache) {
+    accessor.cache->Store(layer, output);
+  }
+}
+
+template <typename T>
+dm_env_rpc::v1::Tensor FeatureLayer8bit(
+    const T& layers, const FeatureLayerAccessor<T>& accessor) {
   const SC2APIProtocol::ImageData& height_map = layers.height_map();
   CHECK_GT(height_map.size().x(), 0)
       << "We expect height_map to always be present in the feature planes";
@@ -126,20 +269,40 @@ dm_env_rpc::v1::Tensor FeatureLayer8bit(const T& layers, int layer_index,
       << "We expect height_map to always be present in the feature planes";
   dm_env_rpc::v1::Tensor output =
       ZeroMatrix<uint8_t>(height_map.size().y(), height_map.size().x());
+  FeatureLayer8bit(layers, accessor, MutableData<uint8_t>(&output));
+  return output;
+}
 
-  const google::protobuf::Descriptor* desc = layers.GetDescriptor();
-  const google::protobuf::Reflection* refl = layers.GetReflection();
-  const google::protobuf::FieldDescriptor* field = desc->field(layer_index);
+// As above, for a layer identified by its field index and name.
+template <typename T>
+dm_env_rpc::v1::Tensor FeatureLayer8bit(const T& layers, int layer_index,
+                                        const std::string& layer_name) {
+  const google::protobuf::FieldDescriptor* field =
+      layers.GetDescriptor()->field(layer_index);
   CHECK(field->name() == layer_name)
       << "Field " << field->name() << " mismatch vs " << layer_name;
-  const auto& layer = dynamic_cast<const SC2APIProtocol::ImageData&>(
-      refl->GetMessage(layers, field));
-
-  EncodeImageData<uint8_t>(layer,
-                           (field->name() == "unit_type" ? PySc2ToUint8
-                            : field->name() == "buffs"   ? PySc2ToUint8Buffs
-                                                         : nullptr),
-                           &output);
+  return FeatureLayer8bit(layers, FeatureLayerAccessors<T>({layer_name})[0]);
+}
+
+// All of the given layers, decoded in order into a single [C, H, W] tensor.
+template <typename T>
+dm_env_rpc::v1::Tensor FeatureLayerStack8bit(
+    const T& layers, const std::vector<FeatureLayerAccessor<T>>& accessors) {
+  const SC2APIProtocol::ImageData& height_map = layers.height_map();
+  CHECK_GT(height_map.size().x(), 0)
+      << "We expect height_map to always be present in the feature planes";
+  CHECK_GT(height_map.size().y(), 0)
+      << "We expect height_map to always be present in the feature planes";
+  int height = height_map.size().y();
+  int width = height_map.size().x();
+  int num_layers = accessors.size();
+  dm_env_rpc::v1::Tensor output =
+      ZeroTensor<uint8_t>({num_layers, height, width});
+  absl::Span<uint8_t> planes = MutableData<uint8_t>(&output);
+  for (int i = 0; i < num_layers; ++i) {
+    FeatureLayer8bit(layers, accessors[i],
+                     planes.subspan(i * height * width, height * width));
+  }
   return output;
 }
 
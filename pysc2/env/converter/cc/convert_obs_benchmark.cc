@@ -0,0 +1,128 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-frame conversion costs measured over the observations in the example
+// recording used by convert_obs_test.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/convert_obs.h"
+#include "pysc2/env/converter/cc/file_util.h"
+#include "pysc2/env/converter/cc/map_util.h"
+#include "pysc2/env/converter/proto/converter.pb.h"
+#include "s2clientprotocol/sc2api.pb.h"
+#include "s2clientprotocol/spatial.pb.h"
+
+namespace pysc2 {
+namespace {
+
+const int kNumUnitTypes = 236;
+const int kNumUnitFeatures = 46;
+const int kNumActionTypes = 556;
+const int kMaxUnitCount = 512;
+
+const std::vector<SC2APIProtocol::ResponseObservation>& Observations() {
+  static const auto* observations = [] {
+    RecordedEpisode env_recording;
+    absl::Status result = GetBinaryProto(
+        "pysc2/env/converter/cc/test_data/recordings/tvt_trunk.pb",
+        &env_recording);
+    CHECK(result.ok()) << result;
+    auto* observations = new std::vector<SC2APIProtocol::ResponseObservation>;
+    for (const auto& observation : env_recording.observations()) {
+      observations->push_back(observation.player());
+    }
+    return observations;
+  }();
+  return *observations;
+}
+
+dm_env_rpc::v1::Tensor RawUnits(
+    const SC2APIProtocol::ResponseObservation& obs) {
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  return RawUnitsFullVec(last_unit_tags, 0, obs.observation().raw_data(),
+                         kMaxUnitCount, true, MakeSize2DI(128, 128),
+                         MakeSize2DI(256, 256), kNumUnitTypes,
+                         kNumUnitFeatures, true, kNumActionTypes, true, true,
+                         nullptr);
+}
+
+void BM_RawUnitsFullVec(benchmark::State& state) {
+  const auto& observations = Observations();
+  for (auto _ : state) {
+    for (const auto& obs : observations) {
+      benchmark::DoNotOptimize(RawUnits(obs));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * observations.size());
+}
+BENCHMARK(BM_RawUnitsFullVec);
+
+void BM_RawUnitsToUint8(benchmark::State& state) {
+  std::vector<dm_env_rpc::v1::Tensor> raw_units;
+  for (const auto& obs : Observations()) {
+    raw_units.push_back(RawUnits(obs));
+  }
+  for (auto _ : state) {
+    for (const auto& tensor : raw_units) {
+      benchmark::DoNotOptimize(RawUnitsToUint8(tensor, kNumUnitFeatures));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * raw_units.size());
+}
+BENCHMARK(BM_RawUnitsToUint8);
+
+void BM_RawUnitsFullVecUint8(benchmark::State& state) {
+  const auto& observations = Observations();
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  for (auto _ : state) {
+    for (const auto& obs : observations) {
+      benchmark::DoNotOptimize(RawUnitsFullVecUint8(
+          last_unit_tags, 0, obs.observation().raw_data(), kMaxUnitCount, true,
+          MakeSize2DI(128, 128), MakeSize2DI(256, 256), kNumUnitTypes,
+          kNumUnitFeatures, true, kNumActionTypes, true, true, nullptr));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * observations.size());
+}
+BENCHMARK(BM_RawUnitsFullVecUint8);
+
+void BM_MinimapFeatureLayer8bit(benchmark::State& state) {
+  const auto& observations = Observations();
+  std::vector<std::string> names = {"height_map", "visibility_map", "creep",
+                                    "player_relative", "alerts"};
+  auto accessors =
+      FeatureLayerAccessors<SC2APIProtocol::FeatureLayersMinimap>(names);
+  for (auto _ : state) {
+    for (const auto& obs : observations) {
+      const auto& minimap =
+          obs.observation().feature_layer_data().minimap_renders();
+      for (const auto& accessor : accessors) {
+        benchmark::DoNotOptimize(FeatureLayer8bit(minimap, accessor));
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * observations.size());
+}
+BENCHMARK(BM_MinimapFeatureLayer8bit);
+
+}  // namespace
+}  // namespace pysc2
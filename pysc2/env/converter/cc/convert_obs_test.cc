@@ -15,16 +15,21 @@
 #include "pysc2/env/converter/cc/convert_obs.h"
 
 #include <cstdint>
+#include <numeric>
 
 
+#include "glog/logging.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "pysc2/env/converter/cc/file_util.h"
+#include "pysc2/env/converter/cc/game_data/uint8_lookup.h"
 #include "pysc2/env/converter/cc/game_data/proto/units.pb.h"
 #include "pysc2/env/converter/cc/map_util.h"
+#include "pysc2/env/converter/cc/raw_camera.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/thread_pool.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/spatial.pb.h"
 
@@ -36,6 +41,46 @@ const int kNumUnitFeatures = 36;
 const int kNumActionTypes = 556;
 const int kAddonTypeIndex = 33;
 
+// Loads the recording which the RawUnitsFullVec tests run on.
+RecordedEpisode LoadRecording() {
+  RecordedEpisode env_recording;
+  absl::Status result = GetBinaryProto(
+      "pysc2/env/converter/cc/test_data/recordings/tvt_trunk.pb",
+      &env_recording);
+  CHECK(result.ok()) << result;
+  return env_recording;
+}
+
+// The raw data of the last observation of `env_recording`.
+const SC2APIProtocol::ObservationRaw& LastRawData(
+    const RecordedEpisode& env_recording) {
+  return env_recording.observations(env_recording.observations_size() - 1)
+      .player()
+      .observation()
+      .raw_data();
+}
+
+// The arguments of RawUnitsFullVec which the tests vary. The others are
+// those of a 128x128 map seen at 256x256, with effects and cargo added.
+struct FullVecArgs {
+  int64_t last_target_unit_tag = 0;
+  int num_unit_features = kNumUnitFeatures;
+  RawCamera* camera = nullptr;
+  RawUnitsLayout layout = RawUnitsLayout::kUnitMajor;
+  ThreadPool* thread_pool = nullptr;
+};
+
+// Calls `full_vec`, RawUnitsFullVec or RawUnitsFullVecUint8, with `args`.
+dm_env_rpc::v1::Tensor FullVec(
+    const absl::flat_hash_set<int64_t>& last_unit_tags,
+    const SC2APIProtocol::ObservationRaw& raw, const FullVecArgs& args = {},
+    decltype(&RawUnitsFullVec) full_vec = &RawUnitsFullVec) {
+  return full_vec(last_unit_tags, args.last_target_unit_tag, raw, 512, true,
+                  MakeSize2DI(128, 128), MakeSize2DI(256, 256), kNumUnitTypes,
+                  args.num_unit_features, true, kNumActionTypes, true, true,
+                  args.camera, args.layout, nullptr, args.thread_pool, 0);
+}
+
 TEST(ConvertObs, FeatureLayerFieldIndicesAreInOrderSpecified) {
   SC2APIProtocol::FeatureLayersMinimap feature_layers;
   std::vector<std::string> layer_names({"player_relative", "height_map"});
@@ -51,6 +96,31 @@ TEST(ConvertObsDeathTest, FeatureLayerFieldIndicesDiesIfLayerNotFound) {
                "Could not find heght_map");
 }
 
+TEST(ConvertObs, FeatureLayerAccessorsMatchFieldIndices) {
+  SC2APIProtocol::FeatureLayersMinimap feature_layers;
+  std::vector<std::string> layer_names({"player_relative", "height_map"});
+  feature_layers.mutable_player_relative();
+  feature_layers.mutable_height_map();
+  auto indices = FeatureLayerFieldIndices(layer_names, feature_layers);
+  auto accessors =
+      FeatureLayerAccessors<SC2APIProtocol::FeatureLayersMinimap>(layer_names);
+  ASSERT_EQ(accessors.size(), layer_names.size());
+  for (int i = 0; i < layer_names.size(); ++i) {
+    const google::protobuf::Message& expected =
+        feature_layers.GetReflection()->GetMessage(
+            feature_layers, feature_layers.GetDescriptor()->field(indices[i]));
+    EXPECT_EQ(&(feature_layers.*accessors[i].layer)(), &expected)
+        << layer_names[i];
+    EXPECT_TRUE(accessors[i].table.empty()) << layer_names[i];
+  }
+}
+
+TEST(ConvertObsDeathTest, FeatureLayerAccessorsDiesIfLayerNotFound) {
+  EXPECT_DEATH(FeatureLayerAccessors<SC2APIProtocol::FeatureLayers>(
+                   {"player_relative", "heght_map"}),
+               "Could not find heght_map");
+}
+
 TEST(ConvertObs, FeatureLayers8Bit) {
   const int dim = 128;
   SC2APIProtocol::FeatureLayersMinimap feature_layers;
@@ -93,6 +163,53 @@ TEST(ConvertObsDeathTest, FeatureLayers8BitDiesIfLayerNameMismatch) {
                "Field height_map mismatch vs player_relative");
 }
 
+SC2APIProtocol::FeatureLayers UnitTypeLayers(const std::vector<int>& ids) {
+  const int dim = 4;
+  SC2APIProtocol::FeatureLayers feature_layers;
+  SC2APIProtocol::ImageData* height_map = feature_layers.mutable_height_map();
+  height_map->mutable_size()->set_x(dim);
+  height_map->mutable_size()->set_y(dim);
+  SC2APIProtocol::ImageData* unit_type = feature_layers.mutable_unit_type();
+  unit_type->mutable_size()->set_x(dim);
+  unit_type->mutable_size()->set_y(dim);
+  unit_type->set_bits_per_pixel(32);
+  std::vector<int32_t> data(dim * dim);
+  for (int k = 0; k < data.size(); ++k) {
+    data[k] = ids[k % ids.size()];
+  }
+  unit_type->set_data(data.data(), data.size() * sizeof(int32_t));
+  return feature_layers;
+}
+
+TEST(ConvertObs, FeatureLayers32BitUnitTypeMatchesPySc2ToUint8) {
+  std::vector<int> ids = {0, Terran::Marine, Protoss::Colossus, Zerg::Drone,
+                          Neutral::Dog};
+  SC2APIProtocol::FeatureLayers feature_layers = UnitTypeLayers(ids);
+  int index = FeatureLayerFieldIndices({"unit_type"}, feature_layers)[0];
+  auto tensor = FeatureLayer8bit(feature_layers, index, "unit_type");
+
+  Matrix<uint8_t> m(tensor);
+  for (int k = 0; k < m.height() * m.width(); ++k) {
+    EXPECT_EQ(m(k / m.width(), k % m.width()),
+              PySc2ToUint8(ids[k % ids.size()]));
+  }
+}
+
+TEST(ConvertObs, FeatureLayers32BitMapsUnknownUnitTypeToUnknown) {
+  SC2APIProtocol::FeatureLayers feature_layers = UnitTypeLayers(
+      {Terran::Marine, 100000, Neutral::DestructibleIce6x6, 2000000000});
+  int index = FeatureLayerFieldIndices({"unit_type"}, feature_layers)[0];
+  auto tensor = FeatureLayer8bit(feature_layers, index, "unit_type");
+
+  Matrix<uint8_t> m(tensor);
+  EXPECT_EQ(m(0, 0), PySc2ToUint8(Terran::Marine));
+  EXPECT_EQ(m(0, 1), kUint8LookupUnknown);
+  EXPECT_EQ(m(0, 2), PySc2ToUint8(Neutral::DestructibleRock6x6));
+  EXPECT_EQ(m(0, 3), kUint8LookupUnknown);
+  EXPECT_EQ(PySc2ToUint8(100000), kUint8LookupUnknown);
+  EXPECT_EQ(PySc2ToUint8(-1), kUint8LookupUnknown);
+}
+
 TEST(ConvertObs, RawUnitsFullVecTerranAddonPopulated) {
   std::string env_recording_path = (
       "pysc2/env/"
@@ -129,5 +246,165 @@ TEST(ConvertObs, RawUnitsFullVecTerranAddonPopulated) {
   ASSERT_EQ(num_addons, 7);
 }
 
+TEST(ConvertObs, RawUnitsFullVecFeatureMajorIsTransposed) {
+  const RecordedEpisode env_recording = LoadRecording();
+  const SC2APIProtocol::ObservationRaw& raw = LastRawData(env_recording);
+
+  absl::flat_hash_set<int64_t> last_unit_tags = {raw.units(0).tag()};
+  FullVecArgs args;
+  args.last_target_unit_tag = raw.units(1).tag();
+  dm_env_rpc::v1::Tensor unit_major = FullVec(last_unit_tags, raw, args);
+  args.layout = RawUnitsLayout::kFeatureMajor;
+  dm_env_rpc::v1::Tensor feature_major = FullVec(last_unit_tags, raw, args);
+
+  Matrix<int32_t> expected(unit_major);
+  Matrix<int32_t> actual(feature_major);
+  ASSERT_EQ(actual.height(), expected.width());
+  ASSERT_EQ(actual.width(), expected.height());
+  for (int i = 0; i < expected.height(); ++i) {
+    for (int j = 0; j < expected.width(); ++j) {
+      ASSERT_EQ(actual(j, i), expected(i, j)) << i << ", " << j;
+    }
+  }
+}
+
+TEST(ConvertObs, RawUnitsFullVecSparseIsTheFilledRows) {
+  const RecordedEpisode env_recording = LoadRecording();
+  const SC2APIProtocol::ObservationRaw& raw = LastRawData(env_recording);
+
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  dm_env_rpc::v1::Tensor padded = FullVec(last_unit_tags, raw);
+  FullVecArgs args;
+  args.layout = RawUnitsLayout::kUnitMajorSparse;
+  dm_env_rpc::v1::Tensor sparse = FullVec(last_unit_tags, raw, args);
+
+  const int num_units = RawUnitsRowCount(raw, true, true);
+  ASSERT_THAT(sparse.shape(), testing::ElementsAre(num_units,
+                                                   kNumUnitFeatures + 2));
+  absl::Span<const int32_t> expected = Data<int32_t>(padded);
+  EXPECT_EQ(Data<int32_t>(sparse),
+            expected.subspan(0, num_units * (kNumUnitFeatures + 2)));
+  for (int32_t value : expected.subspan(num_units * (kNumUnitFeatures + 2))) {
+    ASSERT_EQ(value, 0);
+  }
+
+  dm_env_rpc::v1::TensorSpec spec =
+      RawUnitsSpec(512, kNumUnitTypes, kNumUnitFeatures, kNumActionTypes,
+                   RawUnitsLayout::kUnitMajorSparse);
+  EXPECT_THAT(spec.shape(), testing::ElementsAre(-1, kNumUnitFeatures + 2));
+  EXPECT_FALSE(spec.has_min());
+  EXPECT_FALSE(spec.has_max());
+}
+
+TEST(ConvertObs, RawUnitsFullVecUint8MatchesRawUnitsToUint8) {
+  const RecordedEpisode env_recording = LoadRecording();
+
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  FullVecArgs args;
+  for (int num_unit_features : {39, 46}) {
+    args.num_unit_features = num_unit_features;
+    for (const auto& observation : env_recording.observations()) {
+      const SC2APIProtocol::ObservationRaw& raw =
+          observation.player().observation().raw_data();
+      dm_env_rpc::v1::Tensor expected = RawUnitsToUint8(
+          FullVec(last_unit_tags, raw, args), num_unit_features);
+      dm_env_rpc::v1::Tensor actual =
+          FullVec(last_unit_tags, raw, args, &RawUnitsFullVecUint8);
+      ASSERT_EQ(actual.SerializeAsString(), expected.SerializeAsString());
+    }
+  }
+}
+
+TEST(ConvertObs, RawUnitsFullVecParallelMatchesSerial) {
+  const RecordedEpisode env_recording = LoadRecording();
+
+  ThreadPool thread_pool(4);
+  RawCamera camera(64, 64, 12, 12, 8, 8);
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  FullVecArgs args;
+  args.camera = &camera;
+  for (int num_unit_features : {39, 46}) {
+    args.num_unit_features = num_unit_features;
+    for (RawUnitsLayout layout :
+         {RawUnitsLayout::kUnitMajor, RawUnitsLayout::kFeatureMajor,
+          RawUnitsLayout::kUnitMajorSparse}) {
+      args.layout = layout;
+      for (const auto& observation : env_recording.observations()) {
+        const SC2APIProtocol::ObservationRaw& raw =
+            observation.player().observation().raw_data();
+        for (auto* full_vec : {&RawUnitsFullVec, &RawUnitsFullVecUint8}) {
+          FullVecArgs parallel = args;
+          parallel.thread_pool = &thread_pool;
+          ASSERT_EQ(
+              FullVec(last_unit_tags, raw, parallel, full_vec)
+                  .SerializeAsString(),
+              FullVec(last_unit_tags, raw, args, full_vec).SerializeAsString());
+        }
+      }
+    }
+  }
+}
+
+TEST(ConvertObs, UnitFeatureTier) {
+  EXPECT_EQ(UnitFeatureTier(28), 0);
+  EXPECT_EQ(UnitFeatureTier(33), 33);
+  EXPECT_EQ(UnitFeatureTier(37), 36);
+  EXPECT_EQ(UnitFeatureTier(39), 39);
+  EXPECT_EQ(UnitFeatureTier(45), 41);
+  EXPECT_EQ(UnitFeatureTier(46), 46);
+}
+
+TEST(ConvertObs, RawUnitsFullVecTiersAgreeOnSharedFeatures) {
+  const RecordedEpisode env_recording = LoadRecording();
+  const SC2APIProtocol::ObservationRaw& raw = LastRawData(env_recording);
+
+  absl::flat_hash_set<int64_t> last_unit_tags;
+  auto raw_units = [&](int num_unit_features) {
+    FullVecArgs args;
+    args.num_unit_features = num_unit_features;
+    return RawUnitsToUint8(FullVec(last_unit_tags, raw, args),
+                           num_unit_features);
+  };
+  dm_env_rpc::v1::Tensor all_features = raw_units(46);
+  Matrix<int32_t> expected(all_features);
+
+  // Each of these populates all of its first num_unit_features features.
+  for (int num_unit_features : {34, 35, 36, 40}) {
+    dm_env_rpc::v1::Tensor tensor = raw_units(num_unit_features);
+    Matrix<int32_t> actual(tensor);
+    for (int i = 0; i < actual.height(); ++i) {
+      for (int j = 0; j < num_unit_features; ++j) {
+        ASSERT_EQ(actual(i, j), expected(i, j))
+            << num_unit_features << ": " << i << ", " << j;
+      }
+    }
+  }
+}
+
+TEST(ConvertObs, RawUnitsDeltaEmitsChangedRows) {
+  dm_env_rpc::v1::Tensor raw_units = ZeroMatrix<int32_t>(4, 3);
+  absl::Span<int32_t> data = MutableData<int32_t>(&raw_units);
+  std::iota(data.begin(), data.end(), 0);
+  std::vector<int32_t> previous;
+  dm_env_rpc::v1::Tensor rows;
+  dm_env_rpc::v1::Tensor values;
+
+  // Without a previous frame every row is emitted.
+  RawUnitsDelta(raw_units, &previous, &rows, &values);
+  EXPECT_THAT(Data<int32_t>(rows), testing::ElementsAre(0, 1, 2, 3));
+  EXPECT_EQ(values.SerializeAsString(), raw_units.SerializeAsString());
+
+  RawUnitsDelta(raw_units, &previous, &rows, &values);
+  EXPECT_TRUE(Data<int32_t>(rows).empty());
+  EXPECT_EQ(values.shape(0), 0);
+
+  data[1 * 3 + 2] = 100;
+  data[3 * 3 + 0] = 200;
+  RawUnitsDelta(raw_units, &previous, &rows, &values);
+  EXPECT_THAT(Data<int32_t>(rows), testing::ElementsAre(1, 3));
+  EXPECT_THAT(Data<int32_t>(values),
+              testing::ElementsAre(3, 4, 100, 200, 10, 11));
+}
+
 }  // namespace
 }  // namespace pysc2
@@ -14,14 +14,17 @@
 
 #include "pysc2/env/converter/cc/converter.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "glog/logging.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/cc/convert_obs.h"
 #include "pysc2/env/converter/cc/features.h"
@@ -40,6 +43,12 @@ namespace {
 
 constexpr int kMaxActionDelay = 127;
 
+// Minimap layers which are fixed for the map, or nearly so, and so are only
+// decoded again when their bytes change.
+bool IsStaticMinimapLayer(absl::string_view name) {
+  return name == "height_map" || name == "pathable" || name == "buildable";
+}
+
 }  // namespace
 
 absl::StatusOr<Converter> MakeConverter(
@@ -137,6 +146,20 @@ absl::StatusOr<Converter> MakeConverter(
           "by the agent in a single action. Specified: ",
           raw.max_unit_selection_size()));
     }
+    if (raw.sparse_raw_units() &&
+        (raw.stable_unit_slots() || raw.raw_units_keyframe_interval() > 0)) {
+      return absl::InvalidArgumentError(
+          "sparse_raw_units can't be combined with stable_unit_slots or "
+          "raw_units_keyframe_interval, which both need a fixed number of "
+          "raw_units rows.");
+    }
+    if (raw.stable_unit_slots() &&
+        (raw.add_cargo_to_units() || raw.add_effects_to_units())) {
+      return absl::InvalidArgumentError(
+          "stable_unit_slots can't be combined with add_cargo_to_units or "
+          "add_effects_to_units, as passengers and effects have no tag to "
+          "keep a slot by.");
+    }
   }
 
   return Converter(settings, environment_info);
@@ -153,6 +176,19 @@ Converter::Converter(const ConverterSettings& settings,
     visual_converter_ = std::make_unique<VisualConverter>(settings);
   }
 
+  const auto& minimap_features = settings_.minimap_features();
+  if (!minimap_features.empty()) {
+    minimap_layers_ =
+        FeatureLayerAccessors<SC2APIProtocol::FeatureLayersMinimap>(
+            std::vector<std::string>(minimap_features.cbegin(),
+                                     minimap_features.cend()));
+    for (int i = 0; i < minimap_features.size(); ++i) {
+      if (IsStaticMinimapLayer(minimap_features[i])) {
+        minimap_layers_[i].cache = std::make_shared<FeatureLayerCache>();
+      }
+    }
+  }
+
   // Cache requested races.
   for (const auto& player_info : environment_info.game_info().player_info()) {
     if (player_info.type() != SC2APIProtocol::PlayerType::Observer) {
@@ -160,6 +196,38 @@ Converter::Converter(const ConverterSettings& settings,
     }
   }
   CHECK_EQ(requested_races_.size(), 2) << "Must have 2 non-observer players.";
+
+  observation_layout_ = ObservationLayout(ObservationSpec());
+  slots_ = ResolveSlots(observation_layout_);
+  if (raw_converter_) {
+    raw_slots_ = raw_converter_->ResolveSlots(observation_layout_);
+  } else {
+    visual_slots_ = visual_converter_->ResolveSlots(observation_layout_);
+  }
+}
+
+Converter::Slots Converter::ResolveSlots(
+    const ObservationLayout& layout) const {
+  Slots slots;
+  slots.game_loop = layout.Slot("game_loop");
+  slots.player = layout.Slot("player");
+  slots.home_race_requested = layout.Slot("home_race_requested");
+  slots.away_race_requested = layout.Slot("away_race_requested");
+  slots.away_race_observed = layout.Slot("away_race_observed");
+  slots.upgrades_fixed_length = layout.Slot("upgrades_fixed_length");
+  slots.unit_counts_bow = layout.Slot("unit_counts_bow");
+  slots.minimap_stack = layout.Slot("minimap_stack");
+  for (const std::string& feature : settings_.minimap_features()) {
+    slots.minimap_layers.push_back(
+        layout.Slot(absl::StrCat("minimap_", feature)));
+  }
+  slots.opponent_player = layout.Slot("opponent_player");
+  slots.opponent_unit_counts_bow = layout.Slot("opponent_unit_counts_bow");
+  slots.opponent_upgrades_fixed_length =
+      layout.Slot("opponent_upgrades_fixed_length");
+  slots.action_delay = layout.Slot("action/delay");
+  slots.mmr = layout.Slot("mmr");
+  return slots;
 }
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
@@ -185,13 +253,28 @@ Converter::ObservationSpec() const {
   spec["mmr"] = Int32ScalarSpec("mmr");
 
   const auto& minimap_features = settings_.minimap_features();
-  for (size_t i = 0; i < minimap_features.size(); ++i) {
-    const std::string& feature = minimap_features[i];
-    auto name = absl::StrCat("minimap_", feature);
-    auto range = GetMinimapFeatureScale(feature).value();
-    spec[name] = TensorSpec(name, dm_env_rpc::v1::DataType::UINT8,
-                            {settings_.minimap().x(), settings_.minimap().y()},
-                            0, range - 1);
+  if (settings_.stack_feature_layers()) {
+    if (!minimap_features.empty()) {
+      int max_range = 0;
+      for (const std::string& feature : minimap_features) {
+        max_range =
+            std::max(max_range, GetMinimapFeatureScale(feature).value());
+      }
+      spec["minimap_stack"] = TensorSpec(
+          "minimap_stack", dm_env_rpc::v1::DataType::UINT8,
+          {minimap_features.size(), settings_.minimap().x(),
+           settings_.minimap().y()},
+          0, max_range - 1);
+    }
+  } else {
+    for (size_t i = 0; i < minimap_features.size(); ++i) {
+      const std::string& feature = minimap_features[i];
+      auto name = absl::StrCat("minimap_", feature);
+      auto range = GetMinimapFeatureScale(feature).value();
+      spec[name] = TensorSpec(
+          name, dm_env_rpc::v1::DataType::UINT8,
+          {settings_.minimap().x(), settings_.minimap().y()}, 0, range - 1);
+    }
   }
 
   if (settings_.add_opponent_features()) {
@@ -212,41 +295,54 @@ Converter::ObservationSpec() const {
 
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 Converter::ConvertObservation(const Observation& observation) {
-  auto result = raw_converter_
-                    ? raw_converter_->ConvertObservation(observation)
-                    : visual_converter_->ConvertObservation(observation);
-  if (!result.ok()) {
-    return result;
+  ObservationSlots output(observation_layout_);
+  absl::Status status = ConvertObservation(observation, &output);
+  if (!status.ok()) {
+    return status;
+  }
+  return output.MoveToMap(observation_layout_);
+}
+
+absl::Status Converter::ConvertObservation(const Observation& observation,
+                                           ObservationSlots* output) {
+  CHECK_EQ(output->num_slots(), observation_layout_.num_slots());
+  output->Clear();
+  absl::Status status =
+      raw_converter_
+          ? raw_converter_->ConvertObservation(observation, raw_slots_, output)
+          : visual_converter_->ConvertObservation(observation, visual_slots_,
+                                                  output);
+  if (!status.ok()) {
+    return status;
   }
-  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& output = *result;
 
   const SC2APIProtocol::Observation& obs = observation.player().observation();
 
-  output["game_loop"] = GameLoop(obs);
-  output["player"] = MapPlayerIdToOne(PlayerCommon(obs));
-  output["home_race_requested"] = HomeRaceRequested(observation);
-  output["away_race_requested"] = AwayRaceRequested(observation);
-  output["away_race_observed"] = AwayRaceObserved(observation);
-  output["upgrades_fixed_length"] =
-      UpgradesUint8FixedLength(Upgrades(obs), settings_.max_num_upgrades());
-  output["unit_counts_bow"] = AddUnitCountsBowData(
-      UnitToUint8Matrix<int64_t>(UnitCounts(obs, true, false), 0),
-      settings_.num_unit_types(), true);
+  output->Set(slots_.game_loop, GameLoop(obs));
+  output->Set(slots_.player, MapPlayerIdToOne(PlayerCommon(obs)));
+  output->Set(slots_.home_race_requested, HomeRaceRequested(observation));
+  output->Set(slots_.away_race_requested, AwayRaceRequested(observation));
+  output->Set(slots_.away_race_observed, AwayRaceObserved(observation));
+  output->Set(slots_.upgrades_fixed_length,
+              UpgradesUint8FixedLength(Upgrades(obs),
+                                       settings_.max_num_upgrades()));
+  output->Set(slots_.unit_counts_bow,
+              AddUnitCountsBowData(
+                  UnitToUint8Matrix<int64_t>(UnitCounts(obs, true, false), 0),
+                  settings_.num_unit_types(), true));
 
   const auto& minimap_features = settings_.minimap_features();
   if (!minimap_features.empty()) {
     const SC2APIProtocol::FeatureLayersMinimap& layers =
         obs.feature_layer_data().minimap_renders();
-    if (minimap_field_indices_.empty()) {
-      minimap_field_indices_ = FeatureLayerFieldIndices(
-          std::vector<std::string>(minimap_features.cbegin(),
-                                   minimap_features.cend()),
-          layers);
-    }
-    for (size_t i = 0; i < minimap_features.size(); ++i) {
-      output[absl::StrCat("minimap_", minimap_features.at(i))] =
-          FeatureLayer8bit(layers, minimap_field_indices_[i],
-                           minimap_features.at(i));
+    if (settings_.stack_feature_layers()) {
+      output->Set(slots_.minimap_stack,
+                  FeatureLayerStack8bit(layers, minimap_layers_));
+    } else {
+      for (size_t i = 0; i < minimap_features.size(); ++i) {
+        output->Set(slots_.minimap_layers[i],
+                    FeatureLayer8bit(layers, minimap_layers_[i]));
+      }
     }
   }
 
@@ -259,12 +355,15 @@ Converter::ConvertObservation(const Observation& observation) {
     for (int i = 0; i < 10; ++i) {
       v(i) = opponent_player_original.int32s().array(i + 1);
     }
-    output["opponent_player"] = opponent_player;
-    output["opponent_unit_counts_bow"] = AddUnitCountsBowData(
-        UnitToUint8Matrix<int64_t>(UnitCounts(opponent_obs, true, false), 0),
-        settings_.num_unit_types(), true);
-    output["opponent_upgrades_fixed_length"] = UpgradesUint8FixedLength(
-        Upgrades(opponent_obs), settings_.max_num_upgrades());
+    output->Set(slots_.opponent_player, std::move(opponent_player));
+    output->Set(slots_.opponent_unit_counts_bow,
+                AddUnitCountsBowData(UnitToUint8Matrix<int64_t>(
+                                         UnitCounts(opponent_obs, true, false),
+                                         0),
+                                     settings_.num_unit_types(), true));
+    output->Set(slots_.opponent_upgrades_fixed_length,
+                UpgradesUint8FixedLength(Upgrades(opponent_obs),
+                                         settings_.max_num_upgrades()));
   }
 
   if (settings_.supervised()) {
@@ -277,11 +376,11 @@ Converter::ConvertObservation(const Observation& observation) {
     if (delay == 0) {
       return absl::FailedPreconditionError("Must never happen");
     }
-    output["action/delay"] = MakeTensor(delay);
+    output->Set(slots_.action_delay, MakeTensor(delay));
   }
 
-  output["mmr"] = MMR(observation);
-  return result;
+  output->Set(slots_.mmr, MMR(observation));
+  return absl::OkStatus();
 }
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
@@ -317,6 +416,38 @@ absl::StatusOr<pysc2::Action> Converter::ConvertAction(
   return converted;
 }
 
+absl::StatusOr<pysc2::Action> Converter::ConvertAction(const RawAction& action,
+                                                       int delay) {
+  if (!raw_converter_) {
+    return absl::FailedPreconditionError(
+        "Raw actions require raw settings on the converter.");
+  }
+  auto converted_or = raw_converter_->ConvertAction(action);
+  if (!converted_or.ok()) {
+    return converted_or.status();
+  }
+  pysc2::Action converted;
+  *converted.mutable_request_action() = *std::move(converted_or);
+  converted.set_delay(delay);
+  return converted;
+}
+
+absl::StatusOr<pysc2::Action> Converter::ConvertAction(
+    int function, const VisualActionArgs& args, int delay) {
+  if (!visual_converter_) {
+    return absl::FailedPreconditionError(
+        "Visual actions require visual settings on the converter.");
+  }
+  auto converted_or = visual_converter_->ConvertAction(function, args);
+  if (!converted_or.ok()) {
+    return converted_or.status();
+  }
+  pysc2::Action converted;
+  *converted.mutable_request_action() = *std::move(converted_or);
+  converted.set_delay(delay);
+  return converted;
+}
+
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 Converter::DecodeAction(const SC2APIProtocol::RequestAction& action) const {
   if (raw_converter_) {
@@ -16,14 +16,19 @@
 #define PYSC2_ENV_CONVERTER_CC_CONVERTER_H_
 
 #include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/convert_obs.h"
+#include "pysc2/env/converter/cc/observation_slots.h"
 #include "pysc2/env/converter/cc/raw_converter.h"
 #include "pysc2/env/converter/cc/visual_converter.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
+#include "s2clientprotocol/spatial.pb.h"
 
 namespace pysc2 {
 
@@ -50,11 +55,31 @@ class Converter {
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   ConvertObservation(const Observation& observation);
 
+  // A slot for each tensor of ObservationSpec(). Fixed for the lifetime of
+  // the converter, so slots can be looked up once, by name, and reused.
+  const ObservationLayout& observation_layout() const {
+    return observation_layout_;
+  }
+
+  // As above, but writes the tensors into `output`, which must have been made
+  // for observation_layout(), rather than into a new map. Tensors which are
+  // not part of this observation are absent.
+  absl::Status ConvertObservation(const Observation& observation,
+                                  ObservationSlots* output);
+
   // Converts an action specified as a string to tensor map to a proto
   // suitable for sending to the SC2 binary.
   absl::StatusOr<pysc2::Action> ConvertAction(
       const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action);
 
+  // As above, for actions which are already unpacked from their tensors. The
+  // first is for raw converters, the second for visual ones.
+  absl::StatusOr<pysc2::Action> ConvertAction(const RawAction& action,
+                                              int delay);
+  absl::StatusOr<pysc2::Action> ConvertAction(int function,
+                                              const VisualActionArgs& args,
+                                              int delay);
+
   // Converts an SC2 action to agent format.
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   DecodeAction(const SC2APIProtocol::RequestAction& action) const;
@@ -65,10 +90,37 @@ class Converter {
 
   std::unique_ptr<RawConverter> raw_converter_;
   std::unique_ptr<VisualConverter> visual_converter_;
-  std::vector<int> minimap_field_indices_;
+  std::vector<FeatureLayerAccessor<SC2APIProtocol::FeatureLayersMinimap>>
+      minimap_layers_;
   std::vector<SC2APIProtocol::Race> requested_races_;
   SC2APIProtocol::Race away_race_observed_;
 
+  // Slots of the tensors written by ConvertObservation itself.
+  struct Slots {
+    int game_loop;
+    int player;
+    int home_race_requested;
+    int away_race_requested;
+    int away_race_observed;
+    int upgrades_fixed_length;
+    int unit_counts_bow;
+    int minimap_stack;
+    // By index in the minimap features of the settings.
+    std::vector<int> minimap_layers;
+    int opponent_player;
+    int opponent_unit_counts_bow;
+    int opponent_upgrades_fixed_length;
+    int action_delay;
+    int mmr;
+  };
+
+  ObservationLayout observation_layout_;
+  Slots slots_;
+  RawConverter::Slots raw_slots_;
+  VisualConverter::Slots visual_slots_;
+
+  Slots ResolveSlots(const ObservationLayout& layout) const;
+
   dm_env_rpc::v1::Tensor MMR(const Observation& observation) const;
   dm_env_rpc::v1::Tensor HomeRaceRequested(
       const Observation& observation) const;
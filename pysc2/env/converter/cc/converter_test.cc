@@ -15,7 +15,10 @@
 #include "pysc2/env/converter/cc/converter.h"
 
 #include <cstdint>
+#include <numeric>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "glog/logging.h"
 #include "gmock/gmock.h"
@@ -23,9 +26,12 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/cc/check_protos_equal.h"
 #include "pysc2/env/converter/cc/game_data/raw_actions.h"
+#include "pysc2/env/converter/cc/observation_slots.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/common.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
@@ -271,6 +277,187 @@ TEST(RawConverterTest, ConvertActionSmartUnit) {
   EXPECT_TRUE(result.ok()) << result;
 }
 
+TEST(RawConverterTest, TypedActionMatchesTensorAction) {
+  auto converter_or = MakeConverter(MakeSettingsRaw(), MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto& converter = *converter_or;
+
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> raw_smart_unit;
+  raw_smart_unit["delay"] = MakeTensor(31);
+  raw_smart_unit["function"] = MakeTensor(1);
+  raw_smart_unit["queued"] = MakeTensor(1);
+  raw_smart_unit["repeat"] = MakeTensor(0);
+  raw_smart_unit["unit_tags"] = MakeTensor(4);
+  raw_smart_unit["world"] = MakeTensor(5);
+  auto expected_or = converter.ConvertAction(raw_smart_unit);
+  ASSERT_TRUE(expected_or.ok()) << expected_or.status();
+
+  const std::vector<int> unit_tags = {4};
+  RawAction action;
+  action.function = 1;
+  action.world = 5;
+  action.queued = 1;
+  action.unit_tags = unit_tags;
+  auto action_or = converter.ConvertAction(action, /*delay=*/31);
+  ASSERT_TRUE(action_or.ok()) << action_or.status();
+
+  absl::Status result = CheckProtosEqual(*action_or, *expected_or);
+  EXPECT_TRUE(result.ok()) << result;
+  EXPECT_EQ(converter.ConvertAction(/*function=*/1, VisualActionArgs(), 1)
+                .status()
+                .code(),
+            absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(RawConverterTest, StableUnitSlots) {
+  ConverterSettings settings = MakeSettingsRaw();
+  settings.mutable_raw_settings()->set_stable_unit_slots(true);
+  auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto& converter = *converter_or;
+
+  // Returns the tag column of raw_units and raw_units_valid for `tags`.
+  auto convert = [&converter](const std::vector<int>& tags) {
+    Observation observation = MakeObservation();
+    auto* raw_data =
+        observation.mutable_player()->mutable_observation()->mutable_raw_data();
+    for (int tag : tags) {
+      auto* unit = raw_data->add_units();
+      unit->set_tag(tag);
+      unit->set_unit_type(48);
+      unit->set_alliance(SC2APIProtocol::Self);
+      unit->set_display_type(SC2APIProtocol::Visible);
+    }
+    auto converted_or = converter.ConvertObservation(observation);
+    CHECK(converted_or.ok()) << converted_or.status();
+    const auto& raw_units = converted_or->at("raw_units").int32s().array();
+    const auto& valid = converted_or->at("raw_units_valid").int32s().array();
+    std::vector<int> slot_tags;
+    for (int i = 0; i < kMaxUnitCount; ++i) {
+      slot_tags.push_back(raw_units[i * (kNumUnitFeatures + 2) + 29]);
+      EXPECT_EQ(valid[i], slot_tags.back() != 0) << i;
+    }
+    return slot_tags;
+  };
+
+  std::vector<int> expected(kMaxUnitCount, 0);
+  expected[0] = 10;
+  expected[1] = 20;
+  expected[2] = 30;
+  EXPECT_EQ(convert({10, 20, 30}), expected);
+
+  // 20 is gone, so its slot goes to 40; the others keep theirs.
+  expected[1] = 40;
+  expected[3] = 50;
+  EXPECT_EQ(convert({30, 40, 10, 50}), expected);
+
+  // Actions address units by slot.
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> raw_hold_position;
+  raw_hold_position["delay"] = MakeTensor(1);
+  raw_hold_position["function"] = MakeTensor(17);
+  raw_hold_position["queued"] = MakeTensor(0);
+  raw_hold_position["repeat"] = MakeTensor(0);
+  raw_hold_position["unit_tags"] = MakeTensor(1);
+  auto action_or = converter.ConvertAction(raw_hold_position);
+  ASSERT_TRUE(action_or.ok()) << action_or.status();
+  ASSERT_EQ(action_or->request_action().actions_size(), 1);
+  EXPECT_THAT(
+      action_or->request_action().actions(0).action_raw().unit_command()
+          .unit_tags(),
+      testing::ElementsAre(40));
+}
+
+TEST(RawConverterTest, StableUnitSlotsRejectCargoAndEffects) {
+  ConverterSettings settings = MakeSettingsRaw();
+  settings.mutable_raw_settings()->set_stable_unit_slots(true);
+  settings.mutable_raw_settings()->set_add_cargo_to_units(true);
+  EXPECT_EQ(MakeConverter(settings, MakeEnvironmentInfo()).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  settings.mutable_raw_settings()->set_add_cargo_to_units(false);
+  settings.mutable_raw_settings()->set_add_effects_to_units(true);
+  EXPECT_EQ(MakeConverter(settings, MakeEnvironmentInfo()).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(RawConverterTest, RawUnitsDeltaKeyframes) {
+  ConverterSettings settings = MakeSettingsRaw();
+  settings.mutable_raw_settings()->set_stable_unit_slots(true);
+  settings.mutable_raw_settings()->set_raw_units_keyframe_interval(3);
+  auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto& converter = *converter_or;
+  auto obs_spec = converter.ObservationSpec();
+  EXPECT_EQ(obs_spec.count("raw_units"), 0);
+  for (const char* name : {"raw_units_delta_rows", "raw_units_delta_values"}) {
+    EXPECT_FALSE(obs_spec[name].has_min()) << name;
+    EXPECT_FALSE(obs_spec[name].has_max()) << name;
+  }
+
+  // Returns the changed rows and whether the observation is a keyframe.
+  auto convert = [&](const std::vector<int>& health) {
+    Observation observation = MakeObservation();
+    auto* raw_data =
+        observation.mutable_player()->mutable_observation()->mutable_raw_data();
+    for (int i = 0; i < health.size(); ++i) {
+      auto* unit = raw_data->add_units();
+      unit->set_tag(i + 1);
+      unit->set_unit_type(48);
+      unit->set_health(health[i]);
+    }
+    auto converted_or = converter.ConvertObservation(observation);
+    CHECK(converted_or.ok()) << converted_or.status();
+    auto& converted = *converted_or;
+    EXPECT_EQ(converted.count("raw_units"), 0);
+    const auto& values = converted["raw_units_delta_values"];
+    EXPECT_EQ(values.shape(1), kNumUnitFeatures + 2);
+    const auto& rows = converted["raw_units_delta_rows"];
+    EXPECT_EQ(values.shape(0), rows.int32s().array_size());
+    return std::make_pair(ToVector<int>(rows.int32s().array()),
+                          converted["raw_units_keyframe"].int32s().array(0));
+  };
+
+  std::vector<int> all_rows(kMaxUnitCount);
+  std::iota(all_rows.begin(), all_rows.end(), 0);
+  EXPECT_EQ(convert({10, 20, 30}), std::make_pair(all_rows, 1));
+  EXPECT_EQ(convert({10, 25, 30}), std::make_pair(std::vector<int>({1}), 0));
+  EXPECT_EQ(convert({10, 25}), std::make_pair(std::vector<int>({2}), 0));
+  EXPECT_EQ(convert({10, 25}), std::make_pair(all_rows, 1));
+  EXPECT_EQ(convert({10, 25}), std::make_pair(std::vector<int>(), 0));
+}
+
+TEST(RawConverterTest, SparseRawUnits) {
+  ConverterSettings settings = MakeSettingsRaw();
+  settings.mutable_raw_settings()->set_sparse_raw_units(true);
+  auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto& converter = *converter_or;
+
+  auto obs_spec = converter.ObservationSpec();
+  EXPECT_EQ(ToVector(obs_spec["raw_units"].shape()),
+            std::vector<int>({-1, kNumUnitFeatures + 2}));
+  EXPECT_FALSE(obs_spec["raw_units"].has_min());
+  EXPECT_FALSE(obs_spec["raw_units"].has_max());
+  EXPECT_EQ(ToVector(obs_spec["num_units"].max()),
+            std::vector<int>({kMaxUnitCount}));
+
+  Observation observation = MakeObservation();
+  auto* raw_data =
+      observation.mutable_player()->mutable_observation()->mutable_raw_data();
+  for (int tag : {1, 2, 3}) {
+    raw_data->add_units()->set_tag(tag);
+  }
+  auto converted_or = converter.ConvertObservation(observation);
+  ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+  auto& converted = *converted_or;
+  EXPECT_EQ(ToVector<int>(converted["raw_units"].shape()),
+            std::vector<int>({3, kNumUnitFeatures + 2}));
+  EXPECT_EQ(converted["num_units"].int32s().array(0), 3);
+
+  settings.mutable_raw_settings()->set_stable_unit_slots(true);
+  EXPECT_FALSE(MakeConverter(settings, MakeEnvironmentInfo()).ok());
+}
+
 TEST(VisualConverterTest, ActionSpec) {
   auto converter_or =
       MakeConverter(MakeSettingsVisual(), MakeEnvironmentInfo());
@@ -370,6 +557,33 @@ TEST(VisualConverterTest, ConvertActionSmartScreen) {
   EXPECT_TRUE(result.ok()) << result;
 }
 
+TEST(VisualConverterTest, TypedActionMatchesTensorAction) {
+  auto converter_or =
+      MakeConverter(MakeSettingsVisual(), MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto& converter = *converter_or;
+
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> select_rect;
+  select_rect["delay"] = MakeTensor(4);
+  select_rect["function"] = MakeTensor(3);
+  select_rect["select_add"] = MakeTensor(1);
+  select_rect["screen"] = MakeTensor(333);
+  select_rect["screen2"] = MakeTensor(17);
+  auto expected_or = converter.ConvertAction(select_rect);
+  ASSERT_TRUE(expected_or.ok()) << expected_or.status();
+
+  VisualActionArgs args;
+  args.select_add = 1;
+  args.screen = 333;
+  args.screen2 = 17;
+  auto action_or = converter.ConvertAction(/*function=*/3, args, /*delay=*/4);
+  ASSERT_TRUE(action_or.ok()) << action_or.status();
+
+  ASSERT_EQ(action_or->request_action().actions_size(), 1);
+  absl::Status result = CheckProtosEqual(*action_or, *expected_or);
+  EXPECT_TRUE(result.ok()) << result;
+}
+
 class ConverterTest : public testing::TestWithParam<std::string> {};
 
 TEST_P(ConverterTest, Construction) {
@@ -506,6 +720,131 @@ TEST_P(ConverterTest, ObservationMatchesSpec) {
   }
 }
 
+TEST_P(ConverterTest, ObservationSlotsMatchMap) {
+  bool raw = GetParam() == "raw";
+  ConverterSettings settings = raw ? MakeSettingsRaw() : MakeSettingsVisual();
+  auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  auto slots_converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(slots_converter_or.ok()) << slots_converter_or.status();
+
+  const ObservationLayout& layout = slots_converter_or->observation_layout();
+  EXPECT_EQ(layout.num_slots(), converter_or->ObservationSpec().size());
+  ObservationSlots output(layout);
+  // The same slots are reused for each observation.
+  for (int game_loop : {1, 2}) {
+    Observation observation = MakeObservation();
+    observation.mutable_player()->mutable_observation()->set_game_loop(
+        game_loop);
+    auto converted_or = converter_or->ConvertObservation(observation);
+    ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+    absl::Status status =
+        slots_converter_or->ConvertObservation(observation, &output);
+    ASSERT_TRUE(status.ok()) << status;
+
+    for (int slot = 0; slot < layout.num_slots(); ++slot) {
+      const std::string& name = layout.name(slot);
+      auto iter = converted_or->find(name);
+      ASSERT_EQ(output.has(slot), iter != converted_or->cend()) << name;
+      if (output.has(slot)) {
+        absl::Status result = CheckProtosEqual(output.Get(slot), iter->second);
+        EXPECT_TRUE(result.ok()) << name << ": " << result;
+      }
+    }
+    EXPECT_EQ(output.Data<int32_t>(layout.Slot("game_loop")),
+              absl::Span<const int32_t>({game_loop}));
+  }
+}
+
+TEST_P(ConverterTest, StackedFeatureLayersMatchIndividualLayers) {
+  bool raw = GetParam() == "raw";
+  ConverterSettings settings = raw ? MakeSettingsRaw() : MakeSettingsVisual();
+  auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+  settings.set_stack_feature_layers(true);
+  auto stacked_converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+  ASSERT_TRUE(stacked_converter_or.ok()) << stacked_converter_or.status();
+
+  Observation observation = MakeObservation();
+  auto* feature_layers = observation.mutable_player()
+                             ->mutable_observation()
+                             ->mutable_feature_layer_data();
+  std::string* minimap_height_map =
+      feature_layers->mutable_minimap_renders()->mutable_height_map()
+          ->mutable_data();
+  std::string* screen_player_relative =
+      feature_layers->mutable_renders()->mutable_player_relative()
+          ->mutable_data();
+  for (int i = 0; i < minimap_height_map->size(); ++i) {
+    (*minimap_height_map)[i] = i % 251;
+  }
+  for (int i = 0; i < screen_player_relative->size(); ++i) {
+    (*screen_player_relative)[i] = i % 5;
+  }
+
+  auto obs_spec = stacked_converter_or->ObservationSpec();
+  auto converted_or = converter_or->ConvertObservation(observation);
+  ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+  auto stacked_or = stacked_converter_or->ConvertObservation(observation);
+  ASSERT_TRUE(stacked_or.ok()) << stacked_or.status();
+
+  std::vector<std::pair<std::string, std::vector<std::string>>> stacks = {
+      {"minimap", {"height_map", "visibility_map"}}};
+  if (!raw) {
+    stacks.push_back({"screen", {"height_map", "player_relative"}});
+  }
+  for (const auto& [prefix, features] : stacks) {
+    std::string name = absl::StrCat(prefix, "_stack");
+    const dm_env_rpc::v1::Tensor& stack = stacked_or->at(name);
+    EXPECT_EQ(ToVector<int>(stack.shape()),
+              ToVector<int>(obs_spec.at(name).shape()));
+    int size = prefix == "minimap" ? kMinimapSize : kScreenSize;
+    EXPECT_EQ(ToVector<int>(stack.shape()),
+              std::vector<int>({static_cast<int>(features.size()), size, size}));
+    std::string expected;
+    for (const std::string& feature : features) {
+      std::string layer = absl::StrCat(prefix, "_", feature);
+      EXPECT_FALSE(stacked_or->contains(layer)) << layer;
+      expected += converted_or->at(layer).uint8s().array();
+    }
+    EXPECT_EQ(stack.uint8s().array(), expected) << name;
+  }
+}
+
+TEST_P(ConverterTest, StaticMinimapLayersFollowChanges) {
+  bool raw = GetParam() == "raw";
+  for (bool stack : {false, true}) {
+    ConverterSettings settings =
+        raw ? MakeSettingsRaw() : MakeSettingsVisual();
+    settings.set_stack_feature_layers(stack);
+    auto converter_or = MakeConverter(settings, MakeEnvironmentInfo());
+    ASSERT_TRUE(converter_or.ok()) << converter_or.status();
+    auto& converter = *converter_or;
+
+    Observation observation = MakeObservation();
+    std::string* height_map = observation.mutable_player()
+                                  ->mutable_observation()
+                                  ->mutable_feature_layer_data()
+                                  ->mutable_minimap_renders()
+                                  ->mutable_height_map()
+                                  ->mutable_data();
+    std::string original = *height_map;
+    std::string changed = original;
+    changed[3] = 42;
+
+    for (const std::string& data : {original, original, changed, original}) {
+      *height_map = data;
+      auto converted_or = converter.ConvertObservation(observation);
+      ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+      const std::string& decoded =
+          converted_or->at(stack ? "minimap_stack" : "minimap_height_map")
+              .uint8s()
+              .array();
+      EXPECT_EQ(decoded.substr(0, data.size()), data);
+    }
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(ConverterTests, ConverterTest,
                          testing::Values("raw", "visual"));
 
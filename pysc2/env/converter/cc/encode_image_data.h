@@ -15,32 +15,42 @@
 #ifndef PYSC2_ENV_CONVERTER_CC_ENCODE_IMAGE_DATA_H_
 #define PYSC2_ENV_CONVERTER_CC_ENCODE_IMAGE_DATA_H_
 
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <type_traits>
 
 #include "glog/logging.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/unpack_bits.h"
 #include "s2clientprotocol/common.pb.h"
 
 namespace pysc2 {
 
+// The EncodeImageDataNBit functions decode `data` into `output`, a row-major
+// buffer of data.size().x() rows of data.size().y() values.
+
 template <typename T>
 void EncodeImageData1Bit(const SC2APIProtocol::ImageData& data,
-                         dm_env_rpc::v1::Tensor* output) {
-  int k = 0;
-  int size = data.size().y();
-  CHECK_GT(size, 0);
-  MutableMatrix<T> m(output);
-  CHECK_EQ(m.height(), data.size().x());
-  CHECK_EQ(m.width(), data.size().y());
-  CHECK_EQ(data.data().size() * 8, data.size().x() * data.size().y());
-  for (char c : data.data()) {
-    for (int i = 7; i >= 0; --i) {
-      bool value = (c >> i) & 0x1;
-      m(k / size, k % size) = static_cast<T>(value);
-      k++;
+                         absl::Span<T> output) {
+  CHECK_GT(data.size().y(), 0);
+  CHECK_EQ(output.size(), data.size().x() * data.size().y());
+  CHECK_EQ(data.data().size() * 8, output.size());
+  absl::Span<const uint8_t> packed(
+      reinterpret_cast<const uint8_t*>(data.data().data()), data.data().size());
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    UnpackBits(packed, output);
+  } else {
+    int k = 0;
+    for (uint8_t c : packed) {
+      for (int i = 7; i >= 0; --i) {
+        bool value = (c >> i) & 0x1;
+        output[k++] = static_cast<T>(value);
+      }
     }
   }
 }
@@ -48,23 +58,18 @@ void EncodeImageData1Bit(const SC2APIProtocol::ImageData& data,
 template <typename T>
 void EncodeImageData8Bit(const SC2APIProtocol::ImageData& data,
                          const std::function<int(int)>& transform,
-                         dm_env_rpc::v1::Tensor* output) {
-  int k = 0;
-  int size = data.size().y();
-  CHECK_GT(size, 0);
-  MutableMatrix<T> m(output);
-  CHECK_EQ(m.height(), data.size().x());
-  CHECK_EQ(m.width(), data.size().y());
-  CHECK_EQ(data.data().size(), data.size().x() * data.size().y());
+                         absl::Span<T> output) {
+  CHECK_GT(data.size().y(), 0);
+  CHECK_EQ(output.size(), data.size().x() * data.size().y());
+  CHECK_EQ(data.data().size(), output.size());
+  const char* bytes = data.data().data();
   if (transform) {
-    for (char c : data.data()) {
-      m(k / size, k % size) = static_cast<T>(transform(c));
-      k++;
+    for (int k = 0; k < output.size(); ++k) {
+      output[k] = static_cast<T>(transform(bytes[k]));
     }
   } else {
-    for (char c : data.data()) {
-      m(k / size, k % size) = static_cast<T>(c);
-      k++;
+    for (int k = 0; k < output.size(); ++k) {
+      output[k] = static_cast<T>(bytes[k]);
     }
   }
 }
@@ -72,33 +77,74 @@ void EncodeImageData8Bit(const SC2APIProtocol::ImageData& data,
 template <typename T>
 void EncodeImageData32Bit(const SC2APIProtocol::ImageData& data,
                           const std::function<int(int)>& transform,
-                          dm_env_rpc::v1::Tensor* output) {
-  int k = 0;
-  int size = data.size().y();
-  CHECK_GT(size, 0);
-  MutableMatrix<T> m(output);
-  CHECK_EQ(m.height(), data.size().x());
-  CHECK_EQ(m.width(), data.size().y());
+                          absl::Span<T> output) {
+  CHECK_GT(data.size().y(), 0);
+  CHECK_EQ(output.size(), data.size().x() * data.size().y());
   const auto& bytes = data.data();
-  CHECK_EQ(bytes.size(), 4 * data.size().x() * data.size().y());
-  if (transform) {
-    for (int i = 0; i < bytes.size(); i += 4) {
-      uint32_t value = *reinterpret_cast<const uint32_t*>(&bytes[i]);
-      m(k / size, k % size) = static_cast<T>(transform(value));
-      k++;
-    }
+  CHECK_EQ(bytes.size(), 4 * output.size());
+  for (int k = 0; k < output.size(); ++k) {
+    uint32_t value;
+    std::memcpy(&value, bytes.data() + 4 * k, sizeof(value));
+    output[k] = static_cast<T>(transform ? transform(value) : value);
+  }
+}
+
+// Lookup-table versions of the transforms above: a pixel with value v is
+// written as table[v], or as 0 if v is outside the table.
+template <typename T>
+void EncodeImageData8Bit(const SC2APIProtocol::ImageData& data,
+                         absl::Span<const uint8_t> table,
+                         absl::Span<T> output) {
+  CHECK_GT(data.size().y(), 0);
+  CHECK_EQ(output.size(), data.size().x() * data.size().y());
+  CHECK_EQ(data.data().size(), output.size());
+
+  // Pixels are read as (signed) char, so fold the table down to one entry
+  // per byte value.
+  std::array<uint8_t, 256> byte_table;
+  for (int b = 0; b < 256; ++b) {
+    int value = static_cast<char>(b);
+    byte_table[b] = value >= 0 && value < table.size() ? table[value] : 0;
+  }
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data().data());
+  for (int k = 0; k < output.size(); ++k) {
+    output[k] = static_cast<T>(byte_table[bytes[k]]);
+  }
+}
+
+template <typename T>
+void EncodeImageData32Bit(const SC2APIProtocol::ImageData& data,
+                          absl::Span<const uint8_t> table,
+                          absl::Span<T> output) {
+  CHECK_GT(data.size().y(), 0);
+  CHECK_EQ(output.size(), data.size().x() * data.size().y());
+  const auto& bytes = data.data();
+  CHECK_EQ(bytes.size(), 4 * output.size());
+  for (int k = 0; k < output.size(); ++k) {
+    uint32_t id;
+    std::memcpy(&id, bytes.data() + 4 * k, sizeof(id));
+    output[k] = static_cast<T>(id < table.size() ? table[id] : 0);
+  }
+}
+
+template <typename T = uint8_t>
+void EncodeImageData(const SC2APIProtocol::ImageData& image,
+                     absl::Span<const uint8_t> table, absl::Span<T> output) {
+  if (image.bits_per_pixel() == 8) {
+    EncodeImageData8Bit<T>(image, table, output);
+  } else if (image.bits_per_pixel() == 32) {
+    EncodeImageData32Bit<T>(image, table, output);
   } else {
-    for (int i = 0; i < bytes.size(); i += 4) {
-      m(k / size, k % size) = *reinterpret_cast<const T*>(&bytes[i]);
-      k++;
-    }
+    LOG(FATAL) << "EncodeImageData cannot use a lookup table with "
+               << "bits_per_pixel=" << image.bits_per_pixel();
   }
 }
 
 template <typename T = uint8_t>
 void EncodeImageData(const SC2APIProtocol::ImageData& image,
                      const std::function<int(int)>& transform,
-                     dm_env_rpc::v1::Tensor* output) {
+                     absl::Span<T> output) {
   if (image.bits_per_pixel() == 1) {
     CHECK(transform == nullptr) << "Transform not supported for 1 bit data";
     EncodeImageData1Bit<T>(image, output);
@@ -114,6 +160,31 @@ void EncodeImageData(const SC2APIProtocol::ImageData& image,
   }
 }
 
+// Versions writing to a matrix tensor shaped like the image.
+template <typename T = uint8_t>
+void EncodeImageData(const SC2APIProtocol::ImageData& image,
+                     absl::Span<const uint8_t> table,
+                     dm_env_rpc::v1::Tensor* output) {
+  MutableMatrix<T> m(output);
+  CHECK_EQ(m.height(), image.size().x());
+  CHECK_EQ(m.width(), image.size().y());
+  EncodeImageData<T>(image, table, MutableData<T>(output));
+}
+
+template <typename T = uint8_t>
+void EncodeImageData(const SC2APIProtocol::ImageData& image,
+                     const std::function<int(int)>& transform,
+                     dm_env_rpc::v1::Tensor* output) {
+  if (image.bits_per_pixel() == 0) {
+    CHECK(transform == nullptr) << "Transform not supported for 0 bit data";
+    return;
+  }
+  MutableMatrix<T> m(output);
+  CHECK_EQ(m.height(), image.size().x());
+  CHECK_EQ(m.width(), image.size().y());
+  EncodeImageData<T>(image, transform, MutableData<T>(output));
+}
+
 }  // namespace pysc2
 
 #endif  // PYSC2_ENV_CONVERTER_CC_ENCODE_IMAGE_DATA_H_
@@ -14,8 +14,120 @@
 
 #include "pysc2/env/converter/cc/game_data/uint8_lookup.h"
 
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 
+namespace {
+
+using IdArray = pybind11::array_t<int32_t, pybind11::array::c_style>;
+using Int64Array = pybind11::array_t<int64_t, pybind11::array::c_style>;
+
+// Returns the integers in `data`, an array or anything numpy can make one
+// from, widened to int64. Raises ValueError for any other dtype, or for
+// uint64 values which don't fit, rather than casting them: a float or an
+// out of range id must not turn into a valid one.
+Int64Array IntegerArray(const pybind11::object& data) {
+  pybind11::array array = pybind11::array::ensure(data);
+  if (!array) {
+    throw pybind11::value_error("Expected an array of integers");
+  }
+  const char kind = array.dtype().kind();
+  // Without forcecast, ensure() only casts safely, which excludes uint64.
+  Int64Array ints = kind == 'i' || kind == 'u' ? Int64Array::ensure(array)
+                                               : Int64Array();
+  if (!ints) {
+    throw pybind11::value_error(
+        "Expected an array of integers, not " +
+        std::string(pybind11::str(array.dtype())));
+  }
+  return ints;
+}
+
+void ThrowOutOfRange(int64_t value, int64_t min, int64_t max) {
+  throw pybind11::value_error("Value out of range [" + std::to_string(min) +
+                              ", " + std::to_string(max) +
+                              "]: " + std::to_string(value));
+}
+
+// Index of the first value of `values` outside [min, max], or -1.
+pybind11::ssize_t FindOutOfRange(const int64_t* values,
+                                 pybind11::ssize_t size, int64_t min,
+                                 int64_t max) {
+  for (pybind11::ssize_t k = 0; k < size; ++k) {
+    if (values[k] < min || values[k] > max) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+// Maps every id in `data` through `table`, as the scalar PySc2ToUint8*
+// lookups do. Ids must fit in an int32, as they do in the game. The GIL is
+// released while the ids are mapped.
+IdArray LookUpArray(const pybind11::object& data,
+                    absl::Span<const uint8_t> table) {
+  Int64Array ids = IntegerArray(data);
+  IdArray output(std::vector<pybind11::ssize_t>(ids.shape(),
+                                                ids.shape() + ids.ndim()));
+  const int64_t* in = ids.data();
+  int32_t* out = output.mutable_data();
+  const pybind11::ssize_t size = ids.size();
+  pybind11::ssize_t invalid;
+  {
+    pybind11::gil_scoped_release release;
+    invalid = FindOutOfRange(in, size, std::numeric_limits<int32_t>::min(),
+                             std::numeric_limits<int32_t>::max());
+    if (invalid < 0) {
+      for (pybind11::ssize_t k = 0; k < size; ++k) {
+        int64_t id = in[k];
+        out[k] = id >= 0 && id < static_cast<int64_t>(table.size())
+                     ? table[id]
+                     : pysc2::kUint8LookupUnknown;
+      }
+    }
+  }
+  if (invalid >= 0) {
+    ThrowOutOfRange(in[invalid], std::numeric_limits<int32_t>::min(),
+                    std::numeric_limits<int32_t>::max());
+  }
+  return output;
+}
+
+// Maps every uint8 value in `data` back through `inverse`, which must
+// accept all values in [1, max_value]. Raises ValueError for any other value
+// rather than failing the CHECK in `inverse`.
+IdArray InverseLookUpArray(const pybind11::object& data, int (*inverse)(int),
+                           int max_value) {
+  Int64Array values = IntegerArray(data);
+  IdArray output(std::vector<pybind11::ssize_t>(
+      values.shape(), values.shape() + values.ndim()));
+  const int64_t* in = values.data();
+  int32_t* out = output.mutable_data();
+  const pybind11::ssize_t size = values.size();
+  pybind11::ssize_t invalid;
+  {
+    pybind11::gil_scoped_release release;
+    invalid = FindOutOfRange(in, size, 1, max_value);
+    if (invalid < 0) {
+      for (pybind11::ssize_t k = 0; k < size; ++k) {
+        out[k] = inverse(static_cast<int>(in[k]));
+      }
+    }
+  }
+  if (invalid >= 0) {
+    ThrowOutOfRange(in[invalid], 1, max_value);
+  }
+  return output;
+}
+
+}  // namespace
+
 PYBIND11_MODULE(uint8_lookup, m) {
   m.doc() = "uint8_lookup bindings.";
 
@@ -25,9 +137,45 @@ PYBIND11_MODULE(uint8_lookup, m) {
         pybind11::arg("data"));
   m.def("MaximumUnitTypeId", &pysc2::MaximumUnitTypeId);
   m.def("MaximumBuffId", &pysc2::MaximumBuffId);
+  m.def("MaximumUpgradeId", &pysc2::MaximumUpgradeId);
   m.def("Uint8ToPySc2", &pysc2::Uint8ToPySc2, pybind11::arg("utype"));
   m.def("Uint8ToPySc2Upgrades", &pysc2::Uint8ToPySc2Upgrades,
         pybind11::arg("upgrade_type"));
   m.def("EffectIdIdentity", &pysc2::EffectIdIdentity,
         pybind11::arg("effect_id"));
+
+  // Batch versions of the above over integer numpy arrays of any shape. Each
+  // returns an int32 array of the same shape.
+  m.def(
+      "PySc2ToUint8Array",
+      [](const pybind11::object& data) {
+        return LookUpArray(data, pysc2::PySc2ToUint8Table());
+      },
+      pybind11::arg("data"));
+  m.def(
+      "PySc2ToUint8BuffsArray",
+      [](const pybind11::object& data) {
+        return LookUpArray(data, pysc2::PySc2ToUint8BuffsTable());
+      },
+      pybind11::arg("data"));
+  m.def(
+      "PySc2ToUint8UpgradesArray",
+      [](const pybind11::object& data) {
+        return LookUpArray(data, pysc2::PySc2ToUint8UpgradesTable());
+      },
+      pybind11::arg("data"));
+  m.def(
+      "Uint8ToPySc2Array",
+      [](const pybind11::object& utype) {
+        return InverseLookUpArray(utype, &pysc2::Uint8ToPySc2,
+                                  pysc2::MaximumUnitTypeId());
+      },
+      pybind11::arg("utype"));
+  m.def(
+      "Uint8ToPySc2UpgradesArray",
+      [](const pybind11::object& upgrade_type) {
+        return InverseLookUpArray(upgrade_type, &pysc2::Uint8ToPySc2Upgrades,
+                                  pysc2::MaximumUpgradeId());
+      },
+      pybind11::arg("upgrade_type"));
 }
@@ -13,6 +13,7 @@
 # limitations under the License.
 
 from absl.testing import absltest
+import numpy as np
 from pysc2.env.converter.cc.game_data.proto import buffs_pb2
 from pysc2.env.converter.cc.game_data.proto import units_pb2
 from pysc2.env.converter.cc.game_data.proto import upgrades_pb2
@@ -42,6 +43,51 @@ class Uint8LookupTest(absltest.TestCase):
     self.assertEqual(
         uint8_lookup.Uint8ToPySc2Upgrades(5), upgrades_pb2.Upgrades.Blink)
 
+  def test_pysc2_to_uint8_array(self):
+    ids = np.array([[0, units_pb2.Zerg.InfestedTerran],
+                    [units_pb2.Neutral.DestructibleIce6x6, 100000]])
+    np.testing.assert_array_equal(
+        uint8_lookup.PySc2ToUint8Array(ids),
+        [[0, 4],
+         [uint8_lookup.PySc2ToUint8(units_pb2.Neutral.DestructibleRock6x6),
+          0]])
+
+  def test_pysc2_to_uint8_array_rejects_ids_it_would_narrow(self):
+    with self.assertRaises(ValueError):
+      uint8_lookup.PySc2ToUint8Array(
+          np.array([units_pb2.Zerg.InfestedTerran, 2**32 + 48],
+                   dtype=np.int64))
+    with self.assertRaises(ValueError):
+      uint8_lookup.PySc2ToUint8Array(np.array([2**63], dtype=np.uint64))
+    with self.assertRaises(ValueError):
+      uint8_lookup.PySc2ToUint8Array(np.array([48.5]))
+
+  def test_pysc2_to_uint8_buffs_array(self):
+    ids = np.array([buffs_pb2.Buffs.BlindingCloudStructure, 0])
+    np.testing.assert_array_equal(
+        uint8_lookup.PySc2ToUint8BuffsArray(ids), [3, 0])
+
+  def test_pysc2_to_uint8_upgrades_array(self):
+    ids = np.array([upgrades_pb2.Upgrades.Blink], dtype=np.int64)
+    np.testing.assert_array_equal(
+        uint8_lookup.PySc2ToUint8UpgradesArray(ids), [5])
+
+  def test_uint8_to_pysc2_array(self):
+    values = range(1, uint8_lookup.MaximumUnitTypeId() + 1)
+    np.testing.assert_array_equal(
+        uint8_lookup.Uint8ToPySc2Array(np.array(values)),
+        [uint8_lookup.Uint8ToPySc2(v) for v in values])
+    with self.assertRaises(ValueError):
+      uint8_lookup.Uint8ToPySc2Array(np.array([4, 0]))
+
+  def test_uint8_to_pysc2_upgrades_array(self):
+    np.testing.assert_array_equal(
+        uint8_lookup.Uint8ToPySc2UpgradesArray(np.array([5])),
+        [upgrades_pb2.Upgrades.Blink])
+    with self.assertRaises(ValueError):
+      uint8_lookup.Uint8ToPySc2UpgradesArray(
+          np.array([uint8_lookup.MaximumUpgradeId() + 1]))
+
   def test_effect_id_identity(self):
     self.assertEqual(uint8_lookup.EffectIdIdentity(17), 17)
 
@@ -17,10 +17,9 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
-#include <vector>
+#include <utility>
 
 #include "glog/logging.h"
-#include "absl/container/flat_hash_map.h"
 #include "pysc2/env/converter/cc/game_data/proto/buffs.pb.h"
 #include "pysc2/env/converter/cc/game_data/proto/units.pb.h"
 #include "pysc2/env/converter/cc/game_data/proto/upgrades.pb.h"
@@ -29,7 +28,7 @@ namespace pysc2 {
 namespace {
 
 // Data taken from uint8_unit_lookup.UNIT_LIST.
-std::array<int, 243> kUnitsList = {{
+constexpr std::array<int, 243> kUnitsList = {{
     Protoss::Colossus,
     Terran::TechLab,
     Terran::Reactor,
@@ -277,35 +276,32 @@ std::array<int, 243> kUnitsList = {{
 
 // These units are units that map onto other existing units (or units that
 // don't matter in the case of destructible billboards).
-const absl::flat_hash_map<int, int>& RedundantUnits() {
-  static const auto* redundant_units = new absl::flat_hash_map<int, int>({
-      {Neutral::DestructibleIce4x4, Neutral::DestructibleRockEx14x4},
-      {Neutral::DestructibleIceDiagonalHugeBLUR,
-       Neutral::DestructibleRampDiagonalHugeBLUR},
-      {Neutral::CleaningBot, Neutral::LabBot},
-      {Neutral::Lyote, Neutral::KarakFemale},
-      {Neutral::DestructibleIce6x6, Neutral::DestructibleRock6x6},
-      {Neutral::DestructibleCityDebris6x6, Neutral::DestructibleRock6x6},
-      {Neutral::DestructibleDebris4x4, Neutral::DestructibleRockEx14x4},
-      // Destructible billboards are immobile doodads floating off the map.
-      {Neutral::DestructibleBillboardTall, Neutral::KarakFemale},
-      {Neutral::CollapsibleTerranTower,
-       Neutral::CollapsibleTerranTowerRampLeft},
-      {Neutral::CollapsibleRockTower, Neutral::CollapsibleRockTowerRampLeft},
-      {Neutral::ReptileCrate, Neutral::KarakFemale},
-      {Neutral::Crabeetle, Neutral::KarakFemale},
-      {Neutral::Debris2x2NonConjoined, Neutral::DebrisRampLeft},
-      {Neutral::DestructibleCityDebris4x4, Neutral::DestructibleRockEx14x4},
-      {Neutral::DestructibleRampDiagonalHugeULBR,
-       Neutral::DestructibleRockEx1DiagonalHugeULBR},
-      {Neutral::Dog, Neutral::KarakFemale},
-      {Neutral::InhibitorZoneMedium, Neutral::InhibitorZoneSmall},
-  });
-  return *redundant_units;
-}
+constexpr std::array<std::pair<int, int>, 17> kRedundantUnits = {{
+    {Neutral::DestructibleIce4x4, Neutral::DestructibleRockEx14x4},
+    {Neutral::DestructibleIceDiagonalHugeBLUR,
+     Neutral::DestructibleRampDiagonalHugeBLUR},
+    {Neutral::CleaningBot, Neutral::LabBot},
+    {Neutral::Lyote, Neutral::KarakFemale},
+    {Neutral::DestructibleIce6x6, Neutral::DestructibleRock6x6},
+    {Neutral::DestructibleCityDebris6x6, Neutral::DestructibleRock6x6},
+    {Neutral::DestructibleDebris4x4, Neutral::DestructibleRockEx14x4},
+    // Destructible billboards are immobile doodads floating off the map.
+    {Neutral::DestructibleBillboardTall, Neutral::KarakFemale},
+    {Neutral::CollapsibleTerranTower,
+     Neutral::CollapsibleTerranTowerRampLeft},
+    {Neutral::CollapsibleRockTower, Neutral::CollapsibleRockTowerRampLeft},
+    {Neutral::ReptileCrate, Neutral::KarakFemale},
+    {Neutral::Crabeetle, Neutral::KarakFemale},
+    {Neutral::Debris2x2NonConjoined, Neutral::DebrisRampLeft},
+    {Neutral::DestructibleCityDebris4x4, Neutral::DestructibleRockEx14x4},
+    {Neutral::DestructibleRampDiagonalHugeULBR,
+     Neutral::DestructibleRockEx1DiagonalHugeULBR},
+    {Neutral::Dog, Neutral::KarakFemale},
+    {Neutral::InhibitorZoneMedium, Neutral::InhibitorZoneSmall},
+}};
 
 // Data taken from uint8_buff_types.BUFF_LIST.
-std::array<int, 47> kBuffsList = {
+constexpr std::array<int, 47> kBuffsList = {
     {Buffs::BansheeCloak,
      Buffs::BlindingCloud,
      Buffs::BlindingCloudStructure,
@@ -355,7 +351,7 @@ std::array<int, 47> kBuffsList = {
      Buffs::InhibitorZoneTemporalField}};
 
 // Data taken from uint8_upgrade_fixed_length.UPGRADES_LIST.
-std::array<int, 91> kUpgradesList = {
+constexpr std::array<int, 91> kUpgradesList = {
     {Upgrades::ResonatingGlaives,
      Upgrades::CloakingField,
      Upgrades::HyperflightRotors,
@@ -448,50 +444,69 @@ std::array<int, 91> kUpgradesList = {
      Upgrades::LockOn,
      Upgrades::EnhancedShockwaves}};
 
-template <int32_t size>
-absl::flat_hash_map<int, uint8_t> BuildTable(
-    const std::array<int, size>& list) {
-  absl::flat_hash_map<int, uint8_t> table;
-  table[0] = 0;  // 0 corresponds to the ground (no units).
-  for (int i = 0; i < list.size(); i++) {
-    table[list[i]] = i + 1;
+template <size_t size, size_t num_redundant>
+constexpr int MaxId(const std::array<int, size>& list,
+                    const std::array<std::pair<int, int>, num_redundant>&
+                        redundant_list) {
+  int max_id = 0;
+  for (int id : list) {
+    max_id = std::max(max_id, id);
   }
-  return table;
+  for (const auto& redundant : redundant_list) {
+    max_id = std::max(max_id, redundant.first);
+  }
+  return max_id;
 }
 
-template <int32_t size>
-int LookUp(int data, const std::array<int32_t, size> list,
-           const absl::flat_hash_map<int, int>& redundant_list = {}) {
-  static absl::flat_hash_map<int, uint8_t>* lookup_table =
-      new absl::flat_hash_map<int, uint8_t>(BuildTable<list.size()>(list));
-
-  if (!redundant_list.empty()) {
-    auto redundant = redundant_list.find(data);
-    if (redundant != redundant_list.end()) {
-      data = redundant->second;
-    }
+// Maps each id in `list` to its index + 1, and each redundant id to the value
+// of the id it is folded into. Every other id, including 0 (the ground, when
+// looking up units), maps to kUint8LookupUnknown.
+template <int table_size, size_t size, size_t num_redundant>
+constexpr std::array<uint8_t, table_size> BuildTable(
+    const std::array<int, size>& list,
+    const std::array<std::pair<int, int>, num_redundant>& redundant_list) {
+  static_assert(size < 256, "uint8 lookups are limited to 255 entries");
+  std::array<uint8_t, table_size> table = {};
+  for (int i = 0; i < table_size; ++i) {
+    table[i] = kUint8LookupUnknown;
   }
+  for (int i = 0; i < list.size(); ++i) {
+    table[list[i]] = i + 1;
+  }
+  std::array<uint8_t, table_size> unfolded = table;
+  for (const auto& redundant : redundant_list) {
+    table[redundant.first] = unfolded[redundant.second];
+  }
+  return table;
+}
 
-  auto it = lookup_table->find(data);
+constexpr std::array<std::pair<int, int>, 0> kNoRedundantIds = {};
 
-  CHECK(it != lookup_table->end()) << " Could not find " << data;
+constexpr auto kUnitsTable =
+    BuildTable<MaxId(kUnitsList, kRedundantUnits) + 1>(kUnitsList,
+                                                       kRedundantUnits);
+constexpr auto kBuffsTable =
+    BuildTable<MaxId(kBuffsList, kNoRedundantIds) + 1>(kBuffsList,
+                                                       kNoRedundantIds);
+constexpr auto kUpgradesTable =
+    BuildTable<MaxId(kUpgradesList, kNoRedundantIds) + 1>(kUpgradesList,
+                                                          kNoRedundantIds);
 
-  return it->second;
+template <size_t table_size>
+int LookUp(int data, const std::array<uint8_t, table_size>& table) {
+  if (data < 0 || data >= table_size) {
+    return kUint8LookupUnknown;
+  }
+  return table[data];
 }
 
 }  // namespace
 
-int PySc2ToUint8(int data) {
-  return LookUp<kUnitsList.size()>(data, kUnitsList, RedundantUnits());
-}
+int PySc2ToUint8(int data) { return LookUp(data, kUnitsTable); }
 
-int PySc2ToUint8Buffs(int data) {
-  return LookUp<kBuffsList.size()>(data, kBuffsList);
-}
+int PySc2ToUint8Buffs(int data) { return LookUp(data, kBuffsTable); }
 
-int PySc2ToUint8Upgrades(int data) {
-  return LookUp<kUpgradesList.size()>(data, kUpgradesList);
-}
+int PySc2ToUint8Upgrades(int data) { return LookUp(data, kUpgradesTable); }
 
 int MaximumUnitTypeId() {
   return kUnitsList.size();  // note that the indices have 1 added, hence no -1
@@ -501,6 +516,10 @@ int MaximumBuffId() {
   return kBuffsList.size();  // note that the indices have 1 added, hence no -1
 }
 
+int MaximumUpgradeId() {
+  return kUpgradesList.size();  // indices have 1 added, hence no -1
+}
+
 int Uint8ToPySc2(int utype) {
   CHECK_GT(utype, 0);
   CHECK_LE(utype, kUnitsList.size());
@@ -515,4 +534,12 @@ int Uint8ToPySc2Upgrades(int upgrade_type) {
 
 int EffectIdIdentity(int effect_id) { return effect_id; }
 
+absl::Span<const uint8_t> PySc2ToUint8Table() { return kUnitsTable; }
+
+absl::Span<const uint8_t> PySc2ToUint8BuffsTable() { return kBuffsTable; }
+
+absl::Span<const uint8_t> PySc2ToUint8UpgradesTable() {
+  return kUpgradesTable;
+}
+
 }  // namespace pysc2
@@ -15,17 +15,32 @@
 #ifndef PYSC2_ENV_CONVERTER_CC_GAME_DATA_UINT8_LOOKUP_H_
 #define PYSC2_ENV_CONVERTER_CC_GAME_DATA_UINT8_LOOKUP_H_
 
+#include <cstdint>
+
+#include "absl/types/span.h"
+
 namespace pysc2 {
 
+// Returned by the PySc2ToUint8* lookups for ids that have no mapping, e.g.
+// units added by a newer game build.
+constexpr int kUint8LookupUnknown = 0;
+
 int PySc2ToUint8(int data);
 int PySc2ToUint8Buffs(int data);
 int PySc2ToUint8Upgrades(int data);
 int MaximumUnitTypeId();
 int MaximumBuffId();
+int MaximumUpgradeId();
 int Uint8ToPySc2(int utype);
 int Uint8ToPySc2Upgrades(int upgrade_type);
 int EffectIdIdentity(int effect_id);
 
+// The PySc2ToUint8* lookups as dense tables indexed by id, for transforming
+// whole feature planes at once. Ids past the end of a table are unknown.
+absl::Span<const uint8_t> PySc2ToUint8Table();
+absl::Span<const uint8_t> PySc2ToUint8BuffsTable();
+absl::Span<const uint8_t> PySc2ToUint8UpgradesTable();
+
 }  // namespace pysc2
 
 #endif  // PYSC2_ENV_CONVERTER_GAME_DATA_UINT8_LOOKUP_H_
@@ -18,10 +18,91 @@
 #include <cmath>
 #include <cstdint>
 
+#include "glog/logging.h"
+#include "absl/types/span.h"
 #include "pysc2/env/converter/cc/castops.h"
 #include "s2clientprotocol/common.pb.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 namespace pysc2 {
+namespace {
+
+// The factors from world to minimap pixels, computed as the single point
+// functions do.
+struct MinimapScale {
+  MinimapScale(const SC2APIProtocol::Size2DI& map_size,
+               const SC2APIProtocol::Size2DI& raw_resolution) {
+    float max_dim = std::max(map_size.x(), map_size.y());
+    x = raw_resolution.x() / max_dim;
+    y = raw_resolution.y() / max_dim;
+    map_y = map_size.y();
+  }
+
+  float x;
+  float y;
+  float map_y;
+};
+
+// Converts points from `begin` onwards one at a time.
+void WorldToMinimapPxTail(absl::Span<const float> x, absl::Span<const float> y,
+                          const MinimapScale& scale, int begin,
+                          absl::Span<int32_t> px_x, absl::Span<int32_t> px_y) {
+  for (int i = begin; i < x.size(); ++i) {
+    px_x[i] = ToInt32(std::floor(x[i] * scale.x));
+    px_y[i] = ToInt32(std::floor((scale.map_y - y[i]) * scale.y));
+  }
+}
+
+void WorldToMinimapDistanceTail(absl::Span<const float> distance, float scale,
+                                int begin, absl::Span<int32_t> px_distance) {
+  for (int i = begin; i < distance.size(); ++i) {
+    px_distance[i] = ToInt32(distance[i] * scale);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// 8 points per iteration. The truncating conversion returns INT32_MIN for
+// NaN and out of range values, just like ToInt32.
+__attribute__((target("avx"))) void WorldToMinimapPxAvx(
+    absl::Span<const float> x, absl::Span<const float> y,
+    const MinimapScale& scale, absl::Span<int32_t> px_x,
+    absl::Span<int32_t> px_y) {
+  const __m256 scale_x = _mm256_set1_ps(scale.x);
+  const __m256 scale_y = _mm256_set1_ps(scale.y);
+  const __m256 map_y = _mm256_set1_ps(scale.map_y);
+  int i = 0;
+  for (; i + 8 <= x.size(); i += 8) {
+    __m256 vx = _mm256_mul_ps(_mm256_loadu_ps(x.data() + i), scale_x);
+    __m256 vy = _mm256_mul_ps(
+        _mm256_sub_ps(map_y, _mm256_loadu_ps(y.data() + i)), scale_y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(px_x.data() + i),
+                        _mm256_cvttps_epi32(_mm256_floor_ps(vx)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(px_y.data() + i),
+                        _mm256_cvttps_epi32(_mm256_floor_ps(vy)));
+  }
+  WorldToMinimapPxTail(x, y, scale, i, px_x, px_y);
+}
+
+__attribute__((target("avx"))) void WorldToMinimapDistanceAvx(
+    absl::Span<const float> distance, float scale,
+    absl::Span<int32_t> px_distance) {
+  const __m256 v_scale = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= distance.size(); i += 8) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(distance.data() + i), v_scale);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(px_distance.data() + i),
+                        _mm256_cvttps_epi32(v));
+  }
+  WorldToMinimapDistanceTail(distance, scale, i, px_distance);
+}
+
+#endif
+
+}  // namespace
 
 SC2APIProtocol::PointI WorldToMinimapPx(
     const SC2APIProtocol::Point2D& point,
@@ -55,6 +136,40 @@ int WorldToMinimapDistance(float distance,
   return ToInt32(distance * (raw_resolution.x() / max_dim));
 }
 
+void WorldToMinimapPx(absl::Span<const float> x, absl::Span<const float> y,
+                      const SC2APIProtocol::Size2DI& map_size,
+                      const SC2APIProtocol::Size2DI& raw_resolution,
+                      absl::Span<int32_t> px_x, absl::Span<int32_t> px_y) {
+  CHECK_EQ(y.size(), x.size());
+  CHECK_EQ(px_x.size(), x.size());
+  CHECK_EQ(px_y.size(), x.size());
+  MinimapScale scale(map_size, raw_resolution);
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool use_avx = CpuSupportsAvx();
+  if (use_avx) {
+    WorldToMinimapPxAvx(x, y, scale, px_x, px_y);
+    return;
+  }
+#endif
+  WorldToMinimapPxTail(x, y, scale, 0, px_x, px_y);
+}
+
+void WorldToMinimapDistance(absl::Span<const float> distance,
+                            const SC2APIProtocol::Size2DI& map_size,
+                            const SC2APIProtocol::Size2DI& raw_resolution,
+                            absl::Span<int32_t> px_distance) {
+  CHECK_EQ(px_distance.size(), distance.size());
+  MinimapScale scale(map_size, raw_resolution);
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool use_avx = CpuSupportsAvx();
+  if (use_avx) {
+    WorldToMinimapDistanceAvx(distance, scale.x, px_distance);
+    return;
+  }
+#endif
+  WorldToMinimapDistanceTail(distance, scale.x, 0, px_distance);
+}
+
 SC2APIProtocol::Size2DI MakeSize2DI(int x, int y) {
   SC2APIProtocol::Size2DI size_2di;
   size_2di.set_x(x);
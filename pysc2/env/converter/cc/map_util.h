@@ -15,6 +15,9 @@
 #ifndef PYSC2_ENV_CONVERTER_CC_MAP_UTIL_H_
 #define PYSC2_ENV_CONVERTER_CC_MAP_UTIL_H_
 
+#include <cstdint>
+
+#include "absl/types/span.h"
 #include "s2clientprotocol/common.pb.h"
 
 namespace pysc2 {
@@ -32,6 +35,21 @@ int WorldToMinimapDistance(float distance,
                            const SC2APIProtocol::Size2DI& map_size,
                            const SC2APIProtocol::Size2DI& raw_resolution);
 
+// WorldToMinimapPx over many points at once, giving identical results. Writes
+// the minimap pixel of (x[i], y[i]) to px_x[i] and px_y[i]. Uses SIMD where
+// the CPU supports it.
+void WorldToMinimapPx(absl::Span<const float> x, absl::Span<const float> y,
+                      const SC2APIProtocol::Size2DI& map_size,
+                      const SC2APIProtocol::Size2DI& raw_resolution,
+                      absl::Span<int32_t> px_x, absl::Span<int32_t> px_y);
+
+// WorldToMinimapDistance over many distances at once, giving identical
+// results.
+void WorldToMinimapDistance(absl::Span<const float> distance,
+                            const SC2APIProtocol::Size2DI& map_size,
+                            const SC2APIProtocol::Size2DI& raw_resolution,
+                            absl::Span<int32_t> px_distance);
+
 SC2APIProtocol::Size2DI MakeSize2DI(int x, int y);
 
 }  // namespace pysc2
@@ -0,0 +1,91 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/map_util.h"
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "s2clientprotocol/common.pb.h"
+
+namespace pysc2 {
+namespace {
+
+// World coordinates including values that land exactly on pixel boundaries,
+// as well as ones that don't fit in an int32 once scaled.
+std::vector<float> EdgeValues() {
+  const float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> values = {0.0f,       -0.0f,  0.5f,    1.0f,     -1.0f,
+                               63.999f,    64.0f,  64.001f, 127.5f,   128.0f,
+                               -0.25f,     1e9f,   -1e9f,   2.2e9f,   -2.2e9f,
+                               3e38f,      -3e38f, inf,     -inf,
+                               std::numeric_limits<float>::quiet_NaN(),
+                               std::numeric_limits<float>::denorm_min()};
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-16.0f, 144.0f);
+  for (int i = 0; i < 30; ++i) {
+    values.push_back(dist(rng));
+  }
+  return values;
+}
+
+TEST(MapUtilTest, BatchWorldToMinimapPxMatchesSinglePoints) {
+  const std::vector<float> values = EdgeValues();
+  for (const auto& map_size : {MakeSize2DI(128, 128), MakeSize2DI(184, 176)}) {
+    const SC2APIProtocol::Size2DI raw_resolution = MakeSize2DI(128, 128);
+    // Every length up to a few SIMD blocks, so the tail is covered as well.
+    for (int size = 0; size <= values.size(); ++size) {
+      std::vector<float> x(values.begin(), values.begin() + size);
+      std::vector<float> y(values.rbegin(), values.rbegin() + size);
+      std::vector<int32_t> px_x(size);
+      std::vector<int32_t> px_y(size);
+      WorldToMinimapPx(x, y, map_size, raw_resolution, absl::MakeSpan(px_x),
+                       absl::MakeSpan(px_y));
+      for (int i = 0; i < size; ++i) {
+        SC2APIProtocol::Point2D point;
+        point.set_x(x[i]);
+        point.set_y(y[i]);
+        SC2APIProtocol::PointI expected =
+            WorldToMinimapPx(point, map_size, raw_resolution);
+        ASSERT_EQ(px_x[i], expected.x()) << "x = " << x[i];
+        ASSERT_EQ(px_y[i], expected.y()) << "y = " << y[i];
+      }
+    }
+  }
+}
+
+TEST(MapUtilTest, BatchWorldToMinimapDistanceMatchesSingleDistances) {
+  const std::vector<float> values = EdgeValues();
+  const SC2APIProtocol::Size2DI map_size = MakeSize2DI(184, 176);
+  const SC2APIProtocol::Size2DI raw_resolution = MakeSize2DI(256, 256);
+  for (int size = 0; size <= values.size(); ++size) {
+    absl::Span<const float> distance(values.data(), size);
+    std::vector<int32_t> px_distance(size);
+    WorldToMinimapDistance(distance, map_size, raw_resolution,
+                           absl::MakeSpan(px_distance));
+    for (int i = 0; i < size; ++i) {
+      ASSERT_EQ(px_distance[i],
+                WorldToMinimapDistance(distance[i], map_size, raw_resolution))
+          << "distance = " << distance[i];
+    }
+  }
+}
+
+}  // namespace
+}  // namespace pysc2
@@ -0,0 +1,91 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/observation_slots.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "absl/container/flat_hash_map.h"
+
+namespace pysc2 {
+
+ObservationLayout::ObservationLayout(
+    const absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>& spec) {
+  names_.reserve(spec.size());
+  for (const auto& [name, tensor_spec] : spec) {
+    names_.push_back(name);
+  }
+  std::sort(names_.begin(), names_.end());
+
+  specs_.reserve(names_.size());
+  slots_.reserve(names_.size());
+  for (int slot = 0; slot < names_.size(); ++slot) {
+    specs_.push_back(spec.at(names_[slot]));
+    slots_[names_[slot]] = slot;
+  }
+}
+
+int ObservationLayout::Slot(absl::string_view name) const {
+  auto it = slots_.find(name);
+  return it == slots_.end() ? kNoSlot : it->second;
+}
+
+ObservationSlots::ObservationSlots(const ObservationLayout& layout)
+    : tensors_(layout.num_slots()), present_(layout.num_slots(), false) {}
+
+const dm_env_rpc::v1::Tensor& ObservationSlots::Get(int slot) const {
+  CHECK_GE(slot, 0);
+  CHECK_LT(slot, num_slots());
+  CHECK(present_[slot]) << "Slot " << slot << " was not written";
+  return tensors_[slot];
+}
+
+void ObservationSlots::Set(int slot, dm_env_rpc::v1::Tensor tensor) {
+  CHECK_GE(slot, 0);
+  CHECK_LT(slot, num_slots());
+  tensors_[slot] = std::move(tensor);
+  present_[slot] = true;
+}
+
+dm_env_rpc::v1::Tensor* ObservationSlots::Mutable(int slot) {
+  CHECK_GE(slot, 0);
+  CHECK_LT(slot, num_slots());
+  CHECK(present_[slot]) << "Slot " << slot << " was not written";
+  return &tensors_[slot];
+}
+
+void ObservationSlots::Clear() {
+  std::fill(present_.begin(), present_.end(), false);
+}
+
+absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>
+ObservationSlots::MoveToMap(const ObservationLayout& layout) {
+  CHECK_EQ(layout.num_slots(), num_slots());
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> map;
+  map.reserve(num_slots());
+  for (int slot = 0; slot < num_slots(); ++slot) {
+    if (present_[slot]) {
+      map[layout.name(slot)] = std::move(tensors_[slot]);
+    }
+  }
+  Clear();
+  return map;
+}
+
+}  // namespace pysc2
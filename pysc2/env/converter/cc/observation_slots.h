@@ -0,0 +1,100 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYSC2_ENV_CONVERTER_CC_OBSERVATION_SLOTS_H_
+#define PYSC2_ENV_CONVERTER_CC_OBSERVATION_SLOTS_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/tensor_util.h"
+
+namespace pysc2 {
+
+// Assigns each tensor of an observation spec a slot, in order of name, so
+// that converted observations can be written and read by index. Look slots
+// up once and keep them; Slot() hashes the name.
+class ObservationLayout {
+ public:
+  static constexpr int kNoSlot = -1;
+
+  // A layout with no slots.
+  ObservationLayout() = default;
+  explicit ObservationLayout(
+      const absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>&
+          spec);
+
+  int num_slots() const { return names_.size(); }
+
+  // Returns the slot of `name`, or kNoSlot if the spec has no such tensor.
+  int Slot(absl::string_view name) const;
+
+  const std::string& name(int slot) const { return names_[slot]; }
+  const dm_env_rpc::v1::TensorSpec& spec(int slot) const {
+    return specs_[slot];
+  }
+
+ private:
+  std::vector<std::string> names_;
+  std::vector<dm_env_rpc::v1::TensorSpec> specs_;
+  absl::flat_hash_map<std::string, int> slots_;
+};
+
+// A converted observation, with a tensor for each slot of a layout. Slots
+// which were not written since the last Clear() are absent.
+class ObservationSlots {
+ public:
+  explicit ObservationSlots(const ObservationLayout& layout);
+
+  int num_slots() const { return tensors_.size(); }
+  // Whether `slot` was written. False for kNoSlot and other slots which are
+  // not part of the layout.
+  bool has(int slot) const {
+    return slot >= 0 && slot < num_slots() && present_[slot];
+  }
+
+  const dm_env_rpc::v1::Tensor& Get(int slot) const;
+
+  // The payload of a present slot, which must be of type T.
+  template <typename T>
+  absl::Span<const T> Data(int slot) const {
+    return pysc2::Data<T>(Get(slot));
+  }
+
+  void Set(int slot, dm_env_rpc::v1::Tensor tensor);
+
+  // A present slot, to be modified in place.
+  dm_env_rpc::v1::Tensor* Mutable(int slot);
+
+  // Marks every slot as absent.
+  void Clear();
+
+  // Moves the present tensors into a map keyed by their names in `layout`,
+  // which must be the layout these slots were made for. Clears the slots.
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> MoveToMap(
+      const ObservationLayout& layout);
+
+ private:
+  std::vector<dm_env_rpc::v1::Tensor> tensors_;
+  std::vector<bool> present_;
+};
+
+}  // namespace pysc2
+
+#endif  // PYSC2_ENV_CONVERTER_CC_OBSERVATION_SLOTS_H_
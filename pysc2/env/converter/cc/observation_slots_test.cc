@@ -0,0 +1,75 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/observation_slots.h"
+
+#include <cstdint>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_map.h"
+#include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/tensor_util.h"
+
+namespace pysc2 {
+namespace {
+
+ObservationLayout MakeLayout() {
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec> spec;
+  for (const char* name : {"player", "game_loop", "minimap_creep"}) {
+    spec[name] = Int32ScalarSpec(name);
+  }
+  return ObservationLayout(spec);
+}
+
+TEST(ObservationLayoutTest, SlotsAreInOrderOfName) {
+  ObservationLayout layout = MakeLayout();
+  ASSERT_EQ(layout.num_slots(), 3);
+  EXPECT_EQ(layout.Slot("game_loop"), 0);
+  EXPECT_EQ(layout.Slot("minimap_creep"), 1);
+  EXPECT_EQ(layout.Slot("player"), 2);
+  EXPECT_EQ(layout.Slot("mmr"), ObservationLayout::kNoSlot);
+  for (int slot = 0; slot < layout.num_slots(); ++slot) {
+    EXPECT_EQ(layout.spec(slot).name(), layout.name(slot));
+  }
+}
+
+TEST(ObservationSlotsTest, MoveToMapHasOnlyWrittenSlots) {
+  ObservationLayout layout = MakeLayout();
+  ObservationSlots slots(layout);
+  slots.Set(layout.Slot("player"), MakeTensor(7));
+  slots.Set(layout.Slot("game_loop"), MakeTensor(3));
+  slots.Clear();
+  slots.Set(layout.Slot("game_loop"), MakeTensor(4));
+  EXPECT_FALSE(slots.has(layout.Slot("player")));
+  EXPECT_EQ(slots.Data<int32_t>(layout.Slot("game_loop"))[0], 4);
+
+  auto map = slots.MoveToMap(layout);
+  ASSERT_EQ(map.size(), 1);
+  EXPECT_EQ(ToScalar(map.at("game_loop")), 4);
+  EXPECT_FALSE(slots.has(layout.Slot("game_loop")));
+}
+
+TEST(ObservationSlotsTest, MissingNamesAreNeverPresent) {
+  ObservationLayout layout = MakeLayout();
+  ObservationSlots slots(layout);
+  slots.Set(layout.Slot("player"), MakeTensor(7));
+  EXPECT_FALSE(slots.has(layout.Slot("camera")));
+  EXPECT_FALSE(slots.has(layout.num_slots()));
+  EXPECT_DEATH(slots.Get(layout.Slot("camera")), "Check failed");
+}
+
+}  // namespace
+}  // namespace pysc2
@@ -14,17 +14,53 @@
 
 #include "pysc2/env/converter/cc/converter.h"
 
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
+#include <vector>
 
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
+#include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
 
 namespace {
+
+// Returns a numpy array which views the payload of `tensor` in place. The
+// tensor is moved to the heap and owned by the array, so it lives for exactly
+// as long as Python holds a reference to the data.
+pybind11::array TensorToArray(dm_env_rpc::v1::Tensor tensor) {
+  std::vector<pybind11::ssize_t> shape(tensor.shape().begin(),
+                                       tensor.shape().end());
+  auto* owned = new dm_env_rpc::v1::Tensor(std::move(tensor));
+  pybind11::capsule base(owned, [](void* p) {
+    delete reinterpret_cast<dm_env_rpc::v1::Tensor*>(p);
+  });
+  switch (owned->payload_case()) {
+    case dm_env_rpc::v1::Tensor::kInt32S:
+      return pybind11::array_t<int32_t>(
+          shape, owned->mutable_int32s()->mutable_array()->mutable_data(),
+          base);
+    case dm_env_rpc::v1::Tensor::kInt64S:
+      return pybind11::array_t<int64_t>(
+          shape, owned->mutable_int64s()->mutable_array()->mutable_data(),
+          base);
+    case dm_env_rpc::v1::Tensor::kUint8S:
+      return pybind11::array_t<uint8_t>(
+          shape,
+          reinterpret_cast<uint8_t*>(
+              owned->mutable_uint8s()->mutable_array()->data()),
+          base);
+    default:
+      throw std::runtime_error(
+          "Unhandled payload case when converting tensor to numpy: " +
+          std::to_string(owned->payload_case()));
+  }
+}
+
 class ConverterWrapper {
   // The wrapper serializes and deserializes protos at the
   // pybind11 boundaries since proto formats are inconsistent downstream
@@ -73,6 +109,21 @@ class ConverterWrapper {
     }
     return serialized_obs;
   }
+  // As ConvertObservation, but returns numpy arrays which take ownership of
+  // the converted tensors' buffers rather than serialized Tensor protos.
+  pybind11::dict ConvertObservationToNumpy(const pybind11::bytes& observation) {
+    pysc2::Observation deserialized_obs;
+    deserialized_obs.ParseFromString(observation);
+    auto converted_obs_or = converter_.ConvertObservation(deserialized_obs);
+    if (!converted_obs_or.ok()) {
+      throw std::runtime_error(converted_obs_or.status().ToString());
+    }
+    pybind11::dict arrays;
+    for (auto& p : *converted_obs_or) {
+      arrays[pybind11::str(p.first)] = TensorToArray(std::move(p.second));
+    }
+    return arrays;
+  }
   pybind11::bytes ConvertAction(
       const std::map<std::string, pybind11::bytes>& action) {
     absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>
@@ -117,6 +168,9 @@ PYBIND11_MODULE(converter, m) {
       .def("ActionSpec", &ConverterWrapper::ActionSpec)
       .def("ConvertObservation", &ConverterWrapper::ConvertObservation,
            pybind11::arg("observation"))
+      .def("ConvertObservationToNumpy",
+           &ConverterWrapper::ConvertObservationToNumpy,
+           pybind11::arg("observation"))
       .def("ConvertAction", &ConverterWrapper::ConvertAction,
            pybind11::arg("action"));
 
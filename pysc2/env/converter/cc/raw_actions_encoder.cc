@@ -15,18 +15,21 @@
 #include "pysc2/env/converter/cc/raw_actions_encoder.h"
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
+#include <optional>
 #include <utility>
 #include <vector>
 
 #include "glog/logging.h"
 #include "absl/container/flat_hash_map.h"
-#include "absl/container/flat_hash_set.h"
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "pysc2/env/converter/cc/game_data/raw_actions.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "s2clientprotocol/common.pb.h"
 #include "s2clientprotocol/raw.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
@@ -34,47 +37,119 @@
 namespace pysc2 {
 namespace {
 
-class AbilityIdToGameIdTable {
+constexpr int kNumRawFunctionTypes = RAW_AUTOCAST + 1;
+
+// Lookups into RawFunctions() by ability id, built once so that decoding an
+// action doesn't scan the list of functions.
+class RawFunctionIndex {
  public:
-  AbilityIdToGameIdTable() {
-    for (int i = 0; i < RawFunctions().size(); i++) {
-      if (int ability_id = RawFunctions().at(i).ability_id; ability_id >= 0) {
-        raw_ability_ids_[ability_id].push_back(i);
+  RawFunctionIndex() {
+    const std::vector<RawFunction>& functions = RawFunctions();
+    int max_ability_id = 0;
+    for (const RawFunction& f : functions) {
+      max_ability_id = std::max(max_ability_id, f.ability_id);
+    }
+
+    // The first function of each ability id, and of each id and type.
+    game_ids_.assign(max_ability_id + 1, -1);
+    std::vector<std::array<int, kNumRawFunctionTypes>> exact(
+        max_ability_id + 1);
+    for (auto& e : exact) {
+      e.fill(-1);
+    }
+    for (int i = 0; i < functions.size(); ++i) {
+      const RawFunction& f = functions[i];
+      if (f.ability_id < 0) {
+        continue;
+      }
+      if (game_ids_[f.ability_id] < 0) {
+        game_ids_[f.ability_id] = i;
+      }
+      if (exact[f.ability_id][f.type] < 0) {
+        exact[f.ability_id][f.type] = i;
+      }
+      if (f.type == RAW_MOVE_CAMERA && move_camera_ < 0) {
+        move_camera_ = i;
+      }
+    }
+    CHECK_GT(move_camera_, 0) << "No RAW_MOVE_CAMERA function found";
+
+    // Some actions are "special" versions of a more general action, which
+    // they are mapped to. The first function with the ability id decides:
+    // if it has a general id, it is the general function of the same type,
+    // otherwise the first function with the ability id and type, if any.
+    functions_.assign(max_ability_id + 1, {});
+    for (int ability_id = 0; ability_id <= max_ability_id; ++ability_id) {
+      for (int type = 0; type < kNumRawFunctionTypes; ++type) {
+        int& function_idx = functions_[ability_id][type];
+        function_idx = -1;
+        for (int i = game_ids_[ability_id]; i >= 0 && i < functions.size();
+             ++i) {
+          const RawFunction& f = functions[i];
+          if (f.ability_id != ability_id) {
+            continue;
+          }
+          if (f.general_id) {
+            if (f.general_id <= max_ability_id) {
+              function_idx = exact[f.general_id][type];
+            }
+            break;
+          }
+          if (f.type == type) {
+            function_idx = i;
+            break;
+          }
+        }
       }
     }
   }
 
-  int Lookup(int ability_id) const {
-    if (auto it = raw_ability_ids_.find(ability_id);
-        it != raw_ability_ids_.end()) {
-      const std::vector<int>& ids = it->second;
-      if (auto mt = std::min_element(ids.begin(), ids.end()); mt != ids.end()) {
-        return *mt;
-      }
+  static const RawFunctionIndex& Get() {
+    static const RawFunctionIndex* index = new RawFunctionIndex;
+    return *index;
+  }
+
+  // The agent function of a game ability used as `type`, or -1 if there is
+  // none.
+  int Function(int ability_id, RawFunctionType type) const {
+    if (ability_id < 0 || ability_id >= functions_.size()) {
+      return -1;
+    }
+    return functions_[ability_id][type];
+  }
+
+  int MoveCamera() const { return move_camera_; }
+
+  // The first function with `ability_id`, or 0 if there is none.
+  int GameId(int ability_id) const {
+    if (ability_id < 0 || ability_id >= game_ids_.size()) {
+      return 0;
     }
-    return 0;
+    return std::max(game_ids_[ability_id], 0);
   }
 
  private:
-  absl::flat_hash_map<int, std::vector<int>> raw_ability_ids_;
+  std::vector<std::array<int, kNumRawFunctionTypes>> functions_;
+  std::vector<int> game_ids_;
+  int move_camera_ = -1;
 };
 
-int64_t FindOriginalTag(int position,
-                        const SC2APIProtocol::ObservationRaw& obs) {
-  if (position >= obs.units_size()) {
+int64_t FindOriginalTag(int position, const UnitTable& unit_table) {
+  if (std::optional<uint64_t> tag = unit_table.TagAtRow(position)) {
+    // Assume it's an index.
+    return *tag;
+  } else {
     // Assume it's a real unit tag.
     return position;
-  } else {
-    // Assume it's an index.
-    return obs.units(position).tag();
   }
 }
 
 // Returns the list of unit tags selected by an agent.
-std::vector<int64_t> LookupSelectedUnitTags(
-    const SC2APIProtocol::ObservationRaw& obs, const std::vector<int>& indices,
-    int max_possible_index) {
+std::vector<int64_t> LookupSelectedUnitTags(const UnitTable& unit_table,
+                                            absl::Span<const int> indices,
+                                            int max_possible_index) {
   std::vector<int64_t> out;
+  out.reserve(indices.size());
   for (int index : indices) {
     // The last index is an end of sequence symbol and gets ignored.
     if (index == max_possible_index) {
@@ -85,54 +160,55 @@ std::vector<int64_t> LookupSelectedUnitTags(
       LOG(WARNING) << "Invalid selection_index: " << index << " < 0";
       return out;
     }
-    out.push_back(FindOriginalTag(index, obs));
+    out.push_back(FindOriginalTag(index, unit_table));
   }
   return out;
 }
 
 // Infers the corresponding agent function index from a game action ability_id.
-int FindFunction(int ability_id, RawFunctionType type,
-                 bool map_to_general = true) {
-  int function_idx;
-  for (function_idx = 0; function_idx < RawFunctions().size(); function_idx++) {
-    const RawFunction& f = RawFunctions()[function_idx];
-    if (f.ability_id == ability_id) {
-      // Some actions are "special" versions of a more general action.
-      // We want to map special actions to general ones.
-      // We use the fact that the general_id of a general action is 0.
-      // Otherwise we need an exact match of the function type.
-      if (map_to_general && f.general_id) {
-        // Set map_to_general to false, in case we have a buggy function list.
-        return FindFunction(f.general_id, type, false);
-      } else if (f.type == type) {
-        return function_idx;
-      }
-    }
+int FindFunction(int ability_id, RawFunctionType type) {
+  int function_idx = RawFunctionIndex::Get().Function(ability_id, type);
+  if (function_idx < 0) {
+    // We did not find an ability with the given id and return a no-op.
+    LOG(ERROR) << "No function found with ability " << ability_id;
+    return 0;  // no-op.
   }
-
-  // We did not find an ability with the given id and return a no-op.
-  LOG(ERROR) << "No function found with ability " << ability_id;
-  return 0;  // no-op.
+  return function_idx;
 }
 
-// Inverse of LookupSelectionTags.
+// Inverse of LookupSelectionTags. Returns the raw_units rows of the selected
+// units in increasing order.
 template <typename Container>
-std::vector<int> FindSelectionIndices(const SC2APIProtocol::ObservationRaw& obs,
+std::vector<int> FindSelectionIndices(const UnitTable& unit_table,
                                       const Container& container) {
   // Handle "unit_tags" argument.
-  absl::flat_hash_set<int64_t> selected_unit_tags(container.begin(),
-                                                  container.end());
   std::vector<int> unit_indices;
-  unit_indices.reserve(selected_unit_tags.size());
-  for (int i = 0; i < obs.units_size(); i++) {
-    if (selected_unit_tags.find(obs.units(i).tag()) !=
-        selected_unit_tags.end()) {
-      unit_indices.push_back(i);
+  unit_indices.reserve(container.size());
+  for (int64_t tag : container) {
+    if (int row = unit_table.RowOf(tag); row >= 0) {
+      unit_indices.push_back(row);
     }
   }
+  std::sort(unit_indices.begin(), unit_indices.end());
+  unit_indices.erase(std::unique(unit_indices.begin(), unit_indices.end()),
+                     unit_indices.end());
   return unit_indices;
 }
 
+// The number of unit commands in `actions` with `ability_id`, counting no
+// further than `limit`.
+int CountUnitCommands(const SC2APIProtocol::RequestAction& actions,
+                      int ability_id, int limit) {
+  int count = 0;
+  for (const SC2APIProtocol::Action& action : actions.actions()) {
+    if (action.action_raw().unit_command().ability_id() == ability_id &&
+        ++count == limit) {
+      break;
+    }
+  }
+  return count;
+}
+
 template <typename V>
 std::string KeysString(const absl::flat_hash_map<std::string, V>& map) {
   std::string out;
@@ -155,21 +231,19 @@ RawActionsEncoder::MakeFunctionCall(int function_id, int world, int queued,
   call["function"] = MakeTensor(function_id);
   call["world"] = MakeTensor(world);
   call["queued"] = MakeTensor(queued);
-  dm_env_rpc::v1::Tensor tensor;
-  tensor.add_shape(max_selection_size_);
+  dm_env_rpc::v1::Tensor tensor = ZeroVector<int32_t>(max_selection_size_);
+  absl::Span<int32_t> data = MutableData<int32_t>(&tensor);
   for (int i = 0; i < max_selection_size_; i++) {
-    int data;
     if (i < unit_tags.size()) {
-      data = unit_tags[i];
+      data[i] = unit_tags[i];
     } else {
       // Simulate a quirk of the Python implementation:
       // When we encounter a no_op, we fill the list with zeros instead of the
       // max unit index.
-      data = function_id == 0 ? 0 : max_unit_count_;
+      data[i] = function_id == 0 ? 0 : max_unit_count_;
     }
-    tensor.mutable_int32s()->add_array(data);
   }
-  call["unit_tags"] = tensor;
+  call["unit_tags"] = std::move(tensor);
   call["target_unit_tag"] = MakeTensor(target_unit_tag);
 
   if (action_repeat_) {
@@ -208,6 +282,17 @@ absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>
 RawActionsEncoder::Decode(
     const SC2APIProtocol::ResponseObservation& observation,
     const SC2APIProtocol::RequestAction& actions) const {
+  return Decode(observation,
+                UnitTable(observation.observation().raw_data(),
+                          observation.observation().game_loop()),
+                actions);
+}
+
+absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>
+RawActionsEncoder::Decode(
+    const SC2APIProtocol::ResponseObservation& observation,
+    const UnitTable& unit_table,
+    const SC2APIProtocol::RequestAction& actions) const {
   for (const SC2APIProtocol::Action& action : actions.actions()) {
     if (!action.has_action_raw()) {
       continue;
@@ -219,7 +304,6 @@ RawActionsEncoder::Decode(
     int queued = 0;
     std::vector<int> unit_indices;
     int target_unit_index = 0;
-    const auto& obs = observation.observation().raw_data();
 
     if (action_raw.has_unit_command()) {
       const auto& cmd = action_raw.unit_command();
@@ -236,16 +320,9 @@ RawActionsEncoder::Decode(
 
       // Handle "target_unit_tag" argument.
       if (action_raw.unit_command().has_target_unit_tag()) {
-        bool found = false;
-        for (int i = 0; i < obs.units_size(); i++) {
-          if (action_raw.unit_command().target_unit_tag() ==
-              obs.units(i).tag()) {
-            target_unit_index = i;
-            found = true;
-            break;
-          }
-        }
-        if (!found) {
+        target_unit_index =
+            unit_table.RowOf(action_raw.unit_command().target_unit_tag());
+        if (target_unit_index < 0) {
           // The unit targeted by this action doesn't exist (yet).
           // We skip such actions completely.
           continue;
@@ -259,19 +336,13 @@ RawActionsEncoder::Decode(
       }
 
       // Handle "unit_tags" argument.
-      unit_indices = FindSelectionIndices(obs, cmd.unit_tags());
+      unit_indices = FindSelectionIndices(unit_table, cmd.unit_tags());
 
       // Handle "queued" argument.
       queued = action_raw.unit_command().queue_command() ? 1 : 0;
     } else if (action_raw.has_camera_move()) {
-      for (function_idx = 0; function_idx < RawFunctions().size();
-           function_idx++) {
-        // There is only one RAW_MOVE_CAMERA function.
-        if (RawFunctions()[function_idx].type == RAW_MOVE_CAMERA) {
-          break;
-        }
-      }
-      CHECK_GT(function_idx, 0) << "No RAW_MOVE_CAMERA function found";
+      // There is only one RAW_MOVE_CAMERA function.
+      function_idx = RawFunctionIndex::Get().MoveCamera();
 
       SC2APIProtocol::Point p = action_raw.camera_move().center_world_space();
       SC2APIProtocol::Point2D p2d;
@@ -283,7 +354,7 @@ RawActionsEncoder::Decode(
       // Handle "function_id".
       function_idx = FindFunction(cmd.ability_id(), RAW_AUTOCAST);
       // Handle "unit_tags" argument.
-      unit_indices = FindSelectionIndices(obs, cmd.unit_tags());
+      unit_indices = FindSelectionIndices(unit_table, cmd.unit_tags());
     }
 
     if (function_idx >= num_action_types_) {
@@ -331,21 +402,15 @@ RawActionsEncoder::Decode(
     }
     CHECK_GE(target_unit_index, 0);
 
-    // Count the number of actions this frame with the same ability_id.
-    int num_actions = 0;
-    if (action_raw.has_unit_command()) {
-      for (const SC2APIProtocol::Action& other_action : actions.actions()) {
-        if (other_action.action_raw().unit_command().ability_id() ==
-            action_raw.unit_command().ability_id()) {
-          num_actions++;
-        }
-      }
-    } else {
-      num_actions = 1;
+    // Count the number of actions this frame with the same ability_id. Only
+    // the repeat needs it, which is capped.
+    int num_actions = 1;
+    if (action_repeat_ && action_raw.has_unit_command()) {
+      num_actions = CountUnitCommands(actions,
+                                      action_raw.unit_command().ability_id(),
+                                      kMaxActionRepeat + 1);
     }
 
-    num_actions = std::min(num_actions, 3);
-
     return MakeFunctionCall(function_idx, world, queued, unit_indices,
                             target_unit_index, num_actions - 1);
   }
@@ -358,20 +423,101 @@ absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
     const SC2APIProtocol::ResponseObservation& observation,
     const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action)
     const {
-  // Input: (function, arguments=(world, queued, unit_tags, target_unit_tag))
-
-  SC2APIProtocol::RequestAction output;
+  return Encode(observation,
+                UnitTable(observation.observation().raw_data(),
+                          observation.observation().game_loop()),
+                action);
+}
 
+absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
+    const SC2APIProtocol::ResponseObservation& observation,
+    const UnitTable& unit_table,
+    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action)
+    const {
+  // Input: (function, arguments=(world, queued, unit_tags, target_unit_tag))
   auto function = action.find("function");
   if (function == action.cend()) {
     return absl::InvalidArgumentError(
         "`function` must be specified on all actions.");
   }
-  int m_action_index = ToScalar(function->second);
+  RawAction raw_action;
+  raw_action.function = ToScalar(function->second);
+  if (raw_action.function < 0 ||
+      raw_action.function >= RawFunctions().size()) {
+    return Encode(observation, unit_table, raw_action);
+  }
+
+  // Unpack the arguments which the function uses, in the order in which
+  // Encode uses them.
+  RawFunctionType type = RawFunctions().at(raw_action.function).type;
+  if (type == NO_OP) {
+    return Encode(observation, unit_table, raw_action);
+  }
+  if (type == RAW_MOVE_CAMERA) {
+    if (auto it = action.find("world"); it != action.cend()) {
+      raw_action.world = ToScalar(it->second);
+    } else {
+      return absl::InvalidArgumentError(
+          "`world` must be specified for raw move camera.");
+    }
+    return Encode(observation, unit_table, raw_action);
+  }
+
+  std::vector<int> unit_tags;
+  if (auto it = action.find("unit_tags"); it != action.cend()) {
+    unit_tags = ToVector(it->second);
+    raw_action.unit_tags = unit_tags;
+  } else {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Action requires `unit_tags`, but has keys ", KeysString(action),
+        ", function is ", function->second.DebugString()));
+  }
+  if (type == RAW_AUTOCAST) {
+    return Encode(observation, unit_table, raw_action);
+  }
+
+  if (auto it = action.find("queued"); it != action.cend()) {
+    raw_action.queued = ToScalar(it->second);
+  } else {
+    return absl::InvalidArgumentError(
+        "`queued` must be specified for this action.");
+  }
+  if (type == RAW_CMD_PT) {
+    if (auto it = action.find("world"); it != action.cend()) {
+      raw_action.world = ToScalar(it->second);
+    } else {
+      return absl::InvalidArgumentError(
+          "`world` must be specified for raw command point.");
+    }
+  } else if (type == RAW_CMD_UNIT) {
+    if (auto it = action.find("target_unit_tag"); it != action.cend()) {
+      raw_action.target_unit_tag = ToScalar(it->second);
+    } else {
+      return absl::InvalidArgumentError(
+          "`target_unit_tag` must be specified for raw command unit.");
+    }
+    if (raw_action.target_unit_tag < 0) {
+      // Encoded without a target, whatever the repeat.
+      return Encode(observation, unit_table, raw_action);
+    }
+  }
+  if (action_repeat_) {
+    if (auto it = action.find("repeat"); it != action.cend()) {
+      raw_action.repeat = ToScalar(it->second);
+    } else {
+      return absl::InvalidArgumentError(
+          "Action repeat is enabled so `repeat` must be specified on action.");
+    }
+  }
+  return Encode(observation, unit_table, raw_action);
+}
 
-  const SC2APIProtocol::ObservationRaw& raw_obs =
-      observation.observation().raw_data();
+absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
+    const SC2APIProtocol::ResponseObservation& observation,
+    const UnitTable& unit_table, const RawAction& action) const {
+  SC2APIProtocol::RequestAction output;
 
+  int m_action_index = action.function;
   if (m_action_index < 0 || m_action_index >= RawFunctions().size()) {
     LOG(WARNING) << "Invalid action_index: " << m_action_index;
     return output;
@@ -388,13 +534,7 @@ absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
     SC2APIProtocol::Point* coordinates = out.mutable_action_raw()
                                              ->mutable_camera_move()
                                              ->mutable_center_world_space();
-    SC2APIProtocol::Point2D point2d;
-    if (auto it = action.find("world"); it != action.cend()) {
-      point2d = AgentCoordsToWorldCoords(ToScalar(it->second));
-    } else {
-      return absl::InvalidArgumentError(
-          "`world` must be specified for raw move camera.");
-    }
+    SC2APIProtocol::Point2D point2d = AgentCoordsToWorldCoords(action.world);
     coordinates->set_x(point2d.x());
     coordinates->set_y(point2d.y());
     *output.add_actions() = std::move(out);
@@ -404,15 +544,8 @@ absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
 
   // If the action is neither NO_OP nor MOVE_CAMERA, then we need to send the
   // selected unit tags.
-  std::vector<int64_t> selected_tags;
-  if (auto it = action.find("unit_tags"); it != action.cend()) {
-    selected_tags =
-        LookupSelectedUnitTags(raw_obs, ToVector(it->second), max_unit_count_);
-  } else {
-    return absl::InvalidArgumentError(absl::StrCat(
-        "Action requires `unit_tags`, but has keys ", KeysString(action),
-        ", function is ", function->second.DebugString()));
-  }
+  std::vector<int64_t> selected_tags =
+      LookupSelectedUnitTags(unit_table, action.unit_tags, max_unit_count_);
 
   if (f.type == RAW_AUTOCAST) {
     SC2APIProtocol::ActionRawToggleAutocast* action =
@@ -430,53 +563,24 @@ absl::StatusOr<SC2APIProtocol::RequestAction> RawActionsEncoder::Encode(
       out.mutable_action_raw()->mutable_unit_command();
 
   command->set_ability_id(f.ability_id);
-  if (auto it = action.find("queued"); it != action.cend()) {
-    command->set_queue_command(ToScalar(it->second) != 0);
-  } else {
-    return absl::InvalidArgumentError(
-        "`queued` must be specified for this action.");
-  }
+  command->set_queue_command(action.queued != 0);
   for (int64_t tag : selected_tags) {
     command->add_unit_tags(tag);
   }
 
   if (f.type == RAW_CMD_PT) {
-    int target_pos;
-    if (auto it = action.find("world"); it != action.cend()) {
-      target_pos = ToScalar(it->second);
-    } else {
-      return absl::InvalidArgumentError(
-          "`world` must be specified for raw command point.");
-    }
     SC2APIProtocol::Point2D* p = command->mutable_target_world_space_pos();
-    *p = AgentCoordsToWorldCoords(target_pos);
+    *p = AgentCoordsToWorldCoords(action.world);
   } else if (f.type == RAW_CMD_UNIT) {
-    int target_index;
-    if (auto it = action.find("target_unit_tag"); it != action.cend()) {
-      target_index = ToScalar(it->second);
-    } else {
-      return absl::InvalidArgumentError(
-          "`target_unit_tag` must be specified for raw command unit.");
-    }
+    int target_index = action.target_unit_tag;
     if (target_index < 0) {
       LOG(WARNING) << "Invalid target_index: " << target_index << " < 0";
       return output;
     }
-    command->set_target_unit_tag(FindOriginalTag(target_index, raw_obs));
+    command->set_target_unit_tag(FindOriginalTag(target_index, unit_table));
   }
 
-  int num_actions = -1;
-  if (action_repeat_) {
-    if (auto it = action.find("repeat"); it != action.cend()) {
-      num_actions = ToScalar(it->second) + 1;
-    } else {
-      return absl::InvalidArgumentError(
-          "Action repeat is enabled so `repeat` must be specified on action.");
-    }
-
-  } else {
-    num_actions = 1;
-  }
+  int num_actions = action_repeat_ ? action.repeat + 1 : 1;
   if (f.type != RAW_CMD) {
     // Action repeat is currently only supported for RAW_CMD actions.
     num_actions = 1;
@@ -521,8 +625,7 @@ void PrintAllActions() {
 }
 
 int RawAbilityToGameId(int ability_id) {
-  static AbilityIdToGameIdTable* lookup_table = new AbilityIdToGameIdTable;
-  return lookup_table->Lookup(ability_id);
+  return RawFunctionIndex::Get().GameId(ability_id);
 }
 
 }  // namespace pysc2
@@ -21,13 +21,30 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/random/random.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "s2clientprotocol/common.pb.h"
 #include "s2clientprotocol/raw.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
 
 namespace pysc2 {
 
+// The largest `repeat` of an action, when action repeat is enabled.
+constexpr int kMaxActionRepeat = 2;
+
+// A raw agent action, as the ints of the ActionSpec. Fields which the
+// function does not use are ignored.
+struct RawAction {
+  int function = 0;
+  int world = 0;
+  int queued = 0;
+  // Raw units rows of the selected units. Must outlive the call to Encode.
+  absl::Span<const int> unit_tags;
+  int target_unit_tag = 0;
+  int repeat = 0;
+};
+
 class RawActionsEncoder {
  public:
   RawActionsEncoder(const SC2APIProtocol::Size2DI& map_size, int max_unit_count,
@@ -36,6 +53,9 @@ class RawActionsEncoder {
                     int num_action_types, bool shuffle_unit_tags,
                     bool action_repeat);
 
+  // These build a UnitTable of `observation` on every call. When more than
+  // one action is encoded or decoded per observation, keep a table up to date
+  // and use the overloads below instead, as RawConverter does.
   absl::StatusOr<SC2APIProtocol::RequestAction> Encode(
       const SC2APIProtocol::ResponseObservation& observation,
       const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>&
@@ -45,6 +65,27 @@ class RawActionsEncoder {
       const SC2APIProtocol::ResponseObservation& observation,
       const SC2APIProtocol::RequestAction& action) const;
 
+  // As above, with units looked up in `unit_table`, which must be up to date
+  // with the raw data of `observation`. Units are addressed by their
+  // raw_units row, which is their slot if the table assigns slots.
+  absl::StatusOr<SC2APIProtocol::RequestAction> Encode(
+      const SC2APIProtocol::ResponseObservation& observation,
+      const UnitTable& unit_table,
+      const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>&
+          drastic_action) const;
+
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> Decode(
+      const SC2APIProtocol::ResponseObservation& observation,
+      const UnitTable& unit_table,
+      const SC2APIProtocol::RequestAction& action) const;
+
+  // As above, but for an action which is already unpacked from its tensors.
+  // The map overloads check that the arguments used by the function are
+  // present and forward to this.
+  absl::StatusOr<SC2APIProtocol::RequestAction> Encode(
+      const SC2APIProtocol::ResponseObservation& observation,
+      const UnitTable& unit_table, const RawAction& action) const;
+
   absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> MakeFunctionCall(
       int function_id, int world, int queued, const std::vector<int>& unit_tags,
       int target_unit_tag, int repeat) const;
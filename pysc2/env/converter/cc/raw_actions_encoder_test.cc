@@ -14,6 +14,7 @@
 
 #include "pysc2/env/converter/cc/raw_actions_encoder.h"
 
+#include <algorithm>
 #include <functional>
 #include <string>
 
@@ -28,6 +29,8 @@
 #include "pysc2/env/converter/cc/file_util.h"
 #include "pysc2/env/converter/cc/game_data/raw_actions.h"
 #include "pysc2/env/converter/cc/map_util.h"
+#include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "s2clientprotocol/sc2api.pb.h"
 
 namespace dm_env_rpc {
@@ -59,6 +62,69 @@ SC2APIProtocol::ResponseObservation GetResponseObservation() {
   return obs;
 }
 
+// The linear search which decoding used to do, as a reference.
+int FindFunctionByScan(int ability_id, RawFunctionType type,
+                       bool map_to_general = true) {
+  for (int i = 0; i < RawFunctions().size(); i++) {
+    const RawFunction& f = RawFunctions()[i];
+    if (f.ability_id == ability_id) {
+      if (map_to_general && f.general_id) {
+        return FindFunctionByScan(f.general_id, type, false);
+      } else if (f.type == type) {
+        return i;
+      }
+    }
+  }
+  return 0;
+}
+
+TEST(RawActionsEncoderTest, DecodedFunctionsMatchLinearSearch) {
+  auto obs = GetResponseObservation();
+  const auto& raw_obs = obs.observation().raw_data();
+  RawActionsEncoder encoder(MakeSize2DI(100, 100), kMaxUnitIndex,
+                            kMaxSelectionSize, MakeSize2DI(256, 256),
+                            RawFunctions().size(), false, false);
+  std::vector<int> ability_ids = {-1, 2, 100000};
+  for (const RawFunction& f : RawFunctions()) {
+    ability_ids.push_back(f.ability_id);
+  }
+
+  for (int ability_id : ability_ids) {
+    int first_function = 0;
+    for (int i = RawFunctions().size() - 1; i >= 0; --i) {
+      if (RawFunctions()[i].ability_id == ability_id) {
+        first_function = i;
+      }
+    }
+    EXPECT_EQ(RawAbilityToGameId(ability_id), first_function) << ability_id;
+
+    for (RawFunctionType type :
+         {RAW_CMD, RAW_CMD_PT, RAW_CMD_UNIT, RAW_AUTOCAST}) {
+      SC2APIProtocol::RequestAction request;
+      SC2APIProtocol::ActionRaw* action =
+          request.add_actions()->mutable_action_raw();
+      if (type == RAW_AUTOCAST) {
+        action->mutable_toggle_autocast()->set_ability_id(ability_id);
+        action->mutable_toggle_autocast()->add_unit_tags(
+            raw_obs.units(0).tag());
+      } else {
+        auto* cmd = action->mutable_unit_command();
+        cmd->set_ability_id(ability_id);
+        cmd->add_unit_tags(raw_obs.units(0).tag());
+        if (type == RAW_CMD_PT) {
+          cmd->mutable_target_world_space_pos()->set_x(10);
+          cmd->mutable_target_world_space_pos()->set_y(10);
+        } else if (type == RAW_CMD_UNIT) {
+          cmd->set_target_unit_tag(raw_obs.units(1).tag());
+        }
+      }
+      EXPECT_EQ(ToScalar(encoder.Decode(obs, request).at("function")),
+                FindFunctionByScan(ability_id, type))
+          << ability_id << ", " << type;
+    }
+  }
+}
+
 TEST(RawActionsEncoderTest, RawAutocastActions) {
   auto obs = GetResponseObservation();
   // Find one of the raw autocast functions.
@@ -129,6 +195,45 @@ TEST(RawActionsEncoderTest, ActionRoundTrip) {
   }
 }
 
+TEST(RawActionsEncoderTest, SharedUnitTableRoundTrip) {
+  auto obs = GetResponseObservation();
+  const auto& raw_obs = obs.observation().raw_data();
+  RawActionsEncoder encoder(MakeSize2DI(100, 100), kMaxUnitIndex,
+                            kMaxSelectionSize, MakeSize2DI(256, 256), 529,
+                            false, false);
+  // One table for every call on this observation.
+  UnitTable unit_table(raw_obs, obs.observation().game_loop());
+
+  std::vector<int> unit_tags(kTestSelection.begin(), kTestSelection.end());
+  const auto selected_tags = testing::ElementsAre(
+      raw_obs.units(kTestSelection[0]).tag(),
+      raw_obs.units(kTestSelection[1]).tag(),
+      raw_obs.units(kTestSelection[2]).tag());
+
+  auto attack = encoder.MakeFunctionCall(2, 23452, 0, unit_tags, 0, 0);
+  auto encoded_or = encoder.Encode(obs, unit_table, attack);
+  ASSERT_TRUE(encoded_or.ok()) << encoded_or.status();
+  EXPECT_THAT(encoded_or->actions(0).action_raw().unit_command().unit_tags(),
+              selected_tags);
+  EXPECT_EQ(encoder.Decode(obs, unit_table, *encoded_or), attack);
+
+  auto patrol =
+      encoder.MakeFunctionCall(14, 0, 0, unit_tags, kTestSelection[1], 0);
+  encoded_or = encoder.Encode(obs, unit_table, patrol);
+  ASSERT_TRUE(encoded_or.ok()) << encoded_or.status();
+  const auto& command = encoded_or->actions(0).action_raw().unit_command();
+  EXPECT_THAT(command.unit_tags(), selected_tags);
+  EXPECT_EQ(command.target_unit_tag(), raw_obs.units(kTestSelection[1]).tag());
+  EXPECT_EQ(encoder.Decode(obs, unit_table, *encoded_or), patrol);
+
+  auto autocast = encoder.MakeFunctionCall(200, 0, 0, unit_tags, 0, 0);
+  encoded_or = encoder.Encode(obs, unit_table, autocast);
+  ASSERT_TRUE(encoded_or.ok()) << encoded_or.status();
+  EXPECT_THAT(encoded_or->actions(0).action_raw().toggle_autocast().unit_tags(),
+              selected_tags);
+  EXPECT_EQ(encoder.Decode(obs, unit_table, *encoded_or), autocast);
+}
+
 TEST(RawActionsEncoderTest, RepeatActionRoundTrip) {
   // Testing encoder/decoder round-trips with action repeats enabled.
   auto obs = GetResponseObservation();
@@ -175,5 +280,34 @@ TEST(RawActionsEncoderTest, RepeatActionRoundTrip) {
   }
 }
 
+TEST(RawActionsEncoderTest, RepeatIsCappedAndCountsOnlyTheSameAbility) {
+  auto obs = GetResponseObservation();
+  const auto& raw_obs = obs.observation().raw_data();
+  RawActionsEncoder encoder(MakeSize2DI(100, 100), kMaxUnitIndex,
+                            kMaxSelectionSize, MakeSize2DI(256, 256), 529,
+                            false, true);
+
+  // Train_Marine_quick and HoldPosition_quick, interleaved.
+  auto add_command = [&](SC2APIProtocol::RequestAction* request,
+                         int function_id) {
+    auto* cmd =
+        request->add_actions()->mutable_action_raw()->mutable_unit_command();
+    cmd->set_ability_id(RawFunctions()[function_id].ability_id);
+    cmd->add_unit_tags(raw_obs.units(kTestSelection[0]).tag());
+  };
+  for (int num_marines = 1; num_marines <= 6; ++num_marines) {
+    SC2APIProtocol::RequestAction request;
+    for (int i = 0; i < num_marines; ++i) {
+      add_command(&request, 511);
+      add_command(&request, 17);
+    }
+    request.add_actions()->mutable_action_raw()->mutable_camera_move();
+    auto decoded = encoder.Decode(obs, request);
+    EXPECT_EQ(ToScalar(decoded.at("function")), 511);
+    EXPECT_EQ(ToScalar(decoded.at("repeat")),
+              std::min(num_marines, kMaxActionRepeat + 1) - 1);
+  }
+}
+
 }  // namespace
 }  // namespace pysc2
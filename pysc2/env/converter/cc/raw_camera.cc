@@ -17,7 +17,9 @@
 #include <cstdint>
 
 #include "glog/logging.h"
+#include "absl/types/span.h"
 #include "pysc2/env/converter/cc/map_util.h"
+#include "pysc2/env/converter/cc/tensor_util.h"
 #include "s2clientprotocol/common.pb.h"
 
 namespace pysc2 {
@@ -70,15 +72,15 @@ dm_env_rpc::v1::Tensor RawCamera::RenderCamera(
   CHECK_LT(left, right);
   CHECK_LT(bottom, top);
 
-  dm_env_rpc::v1::Tensor output;
-  output.add_shape(resolution.y());
-  output.add_shape(resolution.x());
+  dm_env_rpc::v1::Tensor output =
+      ZeroMatrix<int32_t>(resolution.y(), resolution.x());
+  absl::Span<int32_t> data = MutableData<int32_t>(&output);
   for (int y = 0; y < resolution.y(); y++) {
     for (int x = 0; x < resolution.x(); x++) {
       // Note that we are lenient with the area here: We include all pixels that
       // get crossed by the camera edges.
-      output.mutable_int32s()->add_array(left <= x && x <= right &&
-                                         bottom <= y && y <= top);
+      data[y * resolution.x() + x] =
+          left <= x && x <= right && bottom <= y && y <= top;
     }
   }
   return output;
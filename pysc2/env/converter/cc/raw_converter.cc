@@ -15,6 +15,7 @@
 #include "pysc2/env/converter/cc/raw_converter.h"
 
 #include <memory>
+#include <utility>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
@@ -28,11 +29,6 @@
 #include "s2clientprotocol/sc2api.pb.h"
 
 namespace pysc2 {
-namespace {
-
-constexpr int kMaxActionRepeat = 2;
-
-}  // namespace
 
 RawConverter::RawConverter(const ConverterSettings& settings,
                            const EnvironmentInfo& environment_info)
@@ -45,18 +41,55 @@ RawConverter::RawConverter(const ConverterSettings& settings,
                            settings.num_action_types(),
                            settings.raw_settings().shuffle_unit_tags(),
                            settings.raw_settings().enable_action_repeat()),
+      raw_units_functions_(RawUnitsFunctionsFor(
+          settings.raw_settings().num_unit_features())),
+      thread_pool_(settings.raw_settings().raw_units_num_threads() > 1
+                       ? std::make_unique<ThreadPool>(
+                             settings.raw_settings().raw_units_num_threads())
+                       : nullptr),
       current_observation_(),
+      unit_table_(settings.raw_settings().stable_unit_slots()
+                      ? UnitTable(settings.raw_settings().max_unit_count())
+                      : UnitTable()),
       last_unit_tags_(),
       last_target_unit_tag_(-1),
-      raw_camera_() {}
+      raw_camera_(),
+      previous_raw_units_(),
+      num_observations_(0),
+      observation_layout_(ObservationSpec()),
+      slots_(ResolveSlots(observation_layout_)) {}
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
 RawConverter::ObservationSpec() const {
   absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec> spec;
   const auto& raw = settings_.raw_settings();
-  spec["raw_units"] =
-      RawUnitsSpec(raw.max_unit_count(), settings_.num_unit_types(),
-                   raw.num_unit_features(), settings_.num_action_types());
+  if (raw.raw_units_keyframe_interval() > 0) {
+    // The number of changed rows varies, so like sparse raw units these
+    // can't be bounded. Rows are in [0, max_unit_count).
+    spec["raw_units_delta_rows"] = TensorSpec(
+        "raw_units_delta_rows", dm_env_rpc::v1::DataType::INT32, {-1});
+    spec["raw_units_delta_values"] = RawUnitsSpec(
+        raw.max_unit_count(), settings_.num_unit_types(),
+        raw.num_unit_features(), settings_.num_action_types(),
+        RawUnitsLayout::kUnitMajorSparse);
+    spec["raw_units_delta_values"].set_name("raw_units_delta_values");
+    spec["raw_units_keyframe"] = Int32ScalarSpec("raw_units_keyframe", 2);
+  } else if (raw.sparse_raw_units()) {
+    spec["raw_units"] = RawUnitsSpec(
+        raw.max_unit_count(), settings_.num_unit_types(),
+        raw.num_unit_features(), settings_.num_action_types(),
+        RawUnitsLayout::kUnitMajorSparse);
+    spec["num_units"] = Int32ScalarSpec("num_units", raw.max_unit_count() + 1);
+  } else {
+    spec["raw_units"] =
+        RawUnitsSpec(raw.max_unit_count(), settings_.num_unit_types(),
+                     raw.num_unit_features(), settings_.num_action_types());
+  }
+  if (raw.stable_unit_slots()) {
+    spec["raw_units_valid"] =
+        TensorSpec("raw_units_valid", dm_env_rpc::v1::DataType::INT32,
+                   {raw.max_unit_count()}, 0, 1);
+  }
 
   if (raw.use_camera_position()) {
     spec["camera_position"] =
@@ -79,12 +112,43 @@ RawConverter::ObservationSpec() const {
   return spec;
 }
 
+RawConverter::Slots RawConverter::ResolveSlots(
+    const ObservationLayout& layout) const {
+  Slots slots;
+  slots.camera_position = layout.Slot("camera_position");
+  slots.camera_size = layout.Slot("camera_size");
+  slots.camera = layout.Slot("camera");
+  slots.raw_units = layout.Slot("raw_units");
+  slots.raw_units_valid = layout.Slot("raw_units_valid");
+  slots.num_units = layout.Slot("num_units");
+  slots.raw_units_delta_rows = layout.Slot("raw_units_delta_rows");
+  slots.raw_units_delta_values = layout.Slot("raw_units_delta_values");
+  slots.raw_units_keyframe = layout.Slot("raw_units_keyframe");
+  if (settings_.supervised()) {
+    for (const auto& [k, v] : ActionSpec()) {
+      slots.actions.emplace_back(k, layout.Slot(absl::StrCat("action/", k)));
+    }
+  }
+  return slots;
+}
+
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 RawConverter::ConvertObservation(const Observation& observation) {
-  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> output;
+  ObservationSlots output(observation_layout_);
+  absl::Status status = ConvertObservation(observation, slots_, &output);
+  if (!status.ok()) {
+    return status;
+  }
+  return output.MoveToMap(observation_layout_);
+}
 
+absl::Status RawConverter::ConvertObservation(const Observation& observation,
+                                              const Slots& slots,
+                                              ObservationSlots* output) {
   // Cache the latest observation.
   current_observation_ = observation.player();
+  unit_table_.Update(current_observation_.observation().raw_data(),
+                     current_observation_.observation().game_loop());
 
   const auto& raw = settings_.raw_settings();
   const auto& map_size = environment_info_.game_info().start_raw().map_size();
@@ -112,29 +176,76 @@ RawConverter::ConvertObservation(const Observation& observation) {
     }
   }
 
+  dm_env_rpc::v1::Tensor camera_position;
+  dm_env_rpc::v1::Tensor camera_size;
   if (raw.use_camera_position()) {
-    output["camera_position"] =
+    camera_position =
         CameraPosition(obs, map_size, raw.resolution(), raw_camera_.get());
-    output["camera_size"] = CameraSize(raw.resolution(), map_size,
-                                       settings_.camera_width_world_units());
+    camera_size = CameraSize(raw.resolution(), map_size,
+                             settings_.camera_width_world_units());
   }
   if (raw.camera()) {
     if (raw.use_virtual_camera()) {
-      output["camera"] = raw_camera_->RenderCamera(map_size, raw.resolution());
+      output->Set(slots.camera,
+                  raw_camera_->RenderCamera(map_size, raw.resolution()));
     } else {
-      output["camera"] = SeparateCamera(
-          output["camera_position"], output["camera_size"], raw.resolution());
+      output->Set(slots.camera, SeparateCamera(camera_position, camera_size,
+                                               raw.resolution()));
     }
   }
+  if (raw.use_camera_position()) {
+    output->Set(slots.camera_position, std::move(camera_position));
+    output->Set(slots.camera_size, std::move(camera_size));
+  }
 
-  output["raw_units"] = RawUnitsToUint8(
-      RawUnitsFullVec(last_unit_tags_, last_target_unit_tag_, obs.raw_data(),
-                      raw.max_unit_count(), true, map_size, raw.resolution(),
-                      settings_.num_unit_types(), raw.num_unit_features(),
-                      raw.mask_offscreen_enemies(),
-                      settings_.num_action_types(), raw.add_effects_to_units(),
-                      raw.add_cargo_to_units(), raw_camera_.get()),
-      raw.num_unit_features());
+  dm_env_rpc::v1::Tensor raw_units;
+  if (raw.stable_unit_slots()) {
+    // Build every unit's row, as units with a slot can be anywhere in the
+    // list. MakeConverter rejects adding passengers and effects, which have
+    // no tag to key a slot on.
+    dm_env_rpc::v1::Tensor all_units = raw_units_functions_.full_vec_uint8(
+        last_unit_tags_, last_target_unit_tag_, obs.raw_data(),
+        obs.raw_data().units_size(), true, map_size, raw.resolution(),
+        settings_.num_unit_types(), raw.num_unit_features(),
+        raw.mask_offscreen_enemies(), settings_.num_action_types(),
+        /*add_effects_to_units=*/false, /*add_cargo_to_units=*/false,
+        raw_camera_.get(),
+        RawUnitsLayout::kFeatureMajor, &unit_table_, thread_pool_.get(),
+        raw.raw_units_parallel_threshold());
+    dm_env_rpc::v1::Tensor valid;
+    raw_units = RawUnitsToSlots(all_units, unit_table_.unit_slots(),
+                                raw.max_unit_count(), &valid);
+    output->Set(slots.raw_units_valid, std::move(valid));
+  } else {
+    raw_units = raw_units_functions_.full_vec_uint8(
+        last_unit_tags_, last_target_unit_tag_, obs.raw_data(),
+        raw.max_unit_count(), true, map_size, raw.resolution(),
+        settings_.num_unit_types(), raw.num_unit_features(),
+        raw.mask_offscreen_enemies(), settings_.num_action_types(),
+        raw.add_effects_to_units(), raw.add_cargo_to_units(),
+        raw_camera_.get(),
+        raw.sparse_raw_units() ? RawUnitsLayout::kUnitMajorSparse
+                               : RawUnitsLayout::kUnitMajor,
+        &unit_table_, thread_pool_.get(), raw.raw_units_parallel_threshold());
+    if (raw.sparse_raw_units()) {
+      output->Set(slots.num_units, MakeTensor(raw_units.shape(0)));
+    }
+  }
+  if (int interval = raw.raw_units_keyframe_interval(); interval > 0) {
+    bool keyframe = num_observations_ % interval == 0;
+    if (keyframe) {
+      previous_raw_units_.clear();
+    }
+    dm_env_rpc::v1::Tensor rows;
+    dm_env_rpc::v1::Tensor values;
+    RawUnitsDelta(raw_units, &previous_raw_units_, &rows, &values);
+    output->Set(slots.raw_units_delta_rows, std::move(rows));
+    output->Set(slots.raw_units_delta_values, std::move(values));
+    output->Set(slots.raw_units_keyframe, MakeTensor(keyframe));
+  } else {
+    output->Set(slots.raw_units, std::move(raw_units));
+  }
+  ++num_observations_;
 
   if (settings_.supervised()) {
     if (!observation.has_force_action_delay()) {
@@ -143,7 +254,7 @@ RawConverter::ConvertObservation(const Observation& observation) {
           "when supervised is enabled.");
     }
     const auto& action = raw_actions_encoder_.Decode(
-        observation.player(), observation.force_action());
+        observation.player(), unit_table_, observation.force_action());
 
     int func_id = ToScalar(action.at("function"));
     if (func_id < 0) {
@@ -156,12 +267,14 @@ RawConverter::ConvertObservation(const Observation& observation) {
                        settings_.num_action_types(), "), but is ", func_id));
     }
 
-    for (const auto& [k, v] : action) {
-      output[absl::StrCat("action/", k)] = v;
+    for (const auto& [k, slot] : slots.actions) {
+      if (auto it = action.find(k); it != action.end()) {
+        output->Set(slot, it->second);
+      }
     }
   }
 
-  return output;
+  return absl::OkStatus();
 }
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
@@ -185,7 +298,18 @@ RawConverter::ActionSpec() const {
 
 absl::StatusOr<SC2APIProtocol::RequestAction> RawConverter::ConvertAction(
     const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action) {
-  auto result = raw_actions_encoder_.Encode(current_observation_, action);
+  return TrackAction(
+      raw_actions_encoder_.Encode(current_observation_, unit_table_, action));
+}
+
+absl::StatusOr<SC2APIProtocol::RequestAction> RawConverter::ConvertAction(
+    const RawAction& action) {
+  return TrackAction(
+      raw_actions_encoder_.Encode(current_observation_, unit_table_, action));
+}
+
+absl::StatusOr<SC2APIProtocol::RequestAction> RawConverter::TrackAction(
+    absl::StatusOr<SC2APIProtocol::RequestAction> result) {
   if (!result.ok()) {
     return result;
   }
@@ -224,7 +348,8 @@ absl::StatusOr<SC2APIProtocol::RequestAction> RawConverter::ConvertAction(
 
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 RawConverter::DecodeAction(const SC2APIProtocol::RequestAction& action) const {
-  return raw_actions_encoder_.Decode(current_observation_, action);
+  return raw_actions_encoder_.Decode(current_observation_, unit_table_,
+                                     action);
 }
 
 }  // namespace pysc2
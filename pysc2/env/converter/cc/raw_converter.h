@@ -17,13 +17,20 @@
 
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/convert_obs.h"
+#include "pysc2/env/converter/cc/observation_slots.h"
 #include "pysc2/env/converter/cc/raw_actions_encoder.h"
 #include "pysc2/env/converter/cc/raw_camera.h"
+#include "pysc2/env/converter/cc/thread_pool.h"
+#include "pysc2/env/converter/cc/unit_table.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
 
@@ -40,26 +47,70 @@ class RawConverter {
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   ConvertObservation(const Observation& observation);
 
+  // Slots of the tensors written by ConvertObservation.
+  struct Slots {
+    int camera_position;
+    int camera_size;
+    int camera;
+    int raw_units;
+    int raw_units_valid;
+    int num_units;
+    int raw_units_delta_rows;
+    int raw_units_delta_values;
+    int raw_units_keyframe;
+    // Decoded action argument names and the slots of their "action/" keys.
+    std::vector<std::pair<std::string, int>> actions;
+  };
+
+  // Looks up the slots of `layout`, which must include ObservationSpec().
+  Slots ResolveSlots(const ObservationLayout& layout) const;
+
+  // As above, writing the tensors into `output`, which is laid out as the
+  // layout `slots` were resolved from.
+  absl::Status ConvertObservation(const Observation& observation,
+                                  const Slots& slots, ObservationSlots* output);
+
   absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec> ActionSpec()
       const;
 
   absl::StatusOr<SC2APIProtocol::RequestAction> ConvertAction(
       const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action);
 
+  // As above, for an action which is already unpacked from its tensors.
+  absl::StatusOr<SC2APIProtocol::RequestAction> ConvertAction(
+      const RawAction& action);
+
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   DecodeAction(const SC2APIProtocol::RequestAction& action) const;
 
  private:
+  // Updates the state kept across actions with an encoded action.
+  absl::StatusOr<SC2APIProtocol::RequestAction> TrackAction(
+      absl::StatusOr<SC2APIProtocol::RequestAction> result);
+
   const ConverterSettings settings_;
   const EnvironmentInfo environment_info_;
 
   RawActionsEncoder raw_actions_encoder_;
+  const RawUnitsFunctions raw_units_functions_;
+  // Set if raw_units is built on more than one thread.
+  std::unique_ptr<ThreadPool> thread_pool_;
 
   // The following fields are the state of the converter during an episode.
   SC2APIProtocol::ResponseObservation current_observation_;
+  // Kept up to date with current_observation_. With stable_unit_slots it
+  // also holds the raw_units row of each unit.
+  UnitTable unit_table_;
   absl::flat_hash_set<int64_t> last_unit_tags_;
   int64_t last_target_unit_tag_;
   std::unique_ptr<RawCamera> raw_camera_;
+  // raw_units as of the previous observation, for delta output.
+  std::vector<int32_t> previous_raw_units_;
+  int num_observations_;
+
+  // For the map overload of ConvertObservation.
+  const ObservationLayout observation_layout_;
+  const Slots slots_;
 };
 
 }  // namespace pysc2
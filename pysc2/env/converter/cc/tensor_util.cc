@@ -15,14 +15,28 @@
 #include "pysc2/env/converter/cc/tensor_util.h"
 
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "glog/logging.h"
 #include "google/protobuf/repeated_field.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 
 namespace pysc2 {
+namespace {
+
+template <typename Shape>
+int GetNumElements(const Shape& shape) {
+  int num_elements = 1;
+  for (auto s : shape) {
+    num_elements *= s;
+  }
+  return num_elements;
+}
+
+}  // namespace
 
 dm_env_rpc::v1::TensorSpec TensorSpec(absl::string_view name,
                                       dm_env_rpc::v1::DataType dtype,
@@ -123,60 +137,97 @@ dm_env_rpc::v1::Tensor MakeTensor(int value) {
 dm_env_rpc::v1::Tensor MakeTensor(const std::vector<int>& values) {
   dm_env_rpc::v1::Tensor tensor;
   tensor.add_shape(values.size());
-  for (auto v : values) {
-    tensor.mutable_int32s()->add_array(v);
-  }
+  tensor.mutable_int32s()->mutable_array()->Add(values.begin(), values.end());
   return tensor;
 }
 
 template <>
-dm_env_rpc::v1::Tensor ZeroVector<int32_t>(int size) {
+dm_env_rpc::v1::Tensor ZeroTensor<int32_t>(const std::vector<int>& shape) {
   dm_env_rpc::v1::Tensor tensor;
-  tensor.add_shape(size);
-  for (int i = 0; i < size; ++i) {
-    tensor.mutable_int32s()->add_array(0);
-  }
+  tensor.mutable_shape()->Add(shape.begin(), shape.end());
+  tensor.mutable_int32s()->mutable_array()->Resize(GetNumElements(shape), 0);
   return tensor;
 }
 
 template <>
-dm_env_rpc::v1::Tensor ZeroMatrix<int32_t>(int y, int x) {
+dm_env_rpc::v1::Tensor ZeroTensor<int64_t>(const std::vector<int>& shape) {
   dm_env_rpc::v1::Tensor tensor;
-  tensor.add_shape(y);
-  tensor.add_shape(x);
-  for (int i = 0; i < y * x; ++i) {
-    tensor.mutable_int32s()->add_array(0);
-  }
+  tensor.mutable_shape()->Add(shape.begin(), shape.end());
+  tensor.mutable_int64s()->mutable_array()->Resize(GetNumElements(shape), 0);
   return tensor;
 }
 
 template <>
-dm_env_rpc::v1::Tensor ZeroMatrix<int64_t>(int y, int x) {
+dm_env_rpc::v1::Tensor ZeroTensor<uint8_t>(const std::vector<int>& shape) {
   dm_env_rpc::v1::Tensor tensor;
-  tensor.add_shape(y);
-  tensor.add_shape(x);
-  for (int i = 0; i < y * x; ++i) {
-    tensor.mutable_int64s()->add_array(0);
-  }
+  tensor.mutable_shape()->Add(shape.begin(), shape.end());
+  tensor.mutable_uint8s()->mutable_array()->assign(GetNumElements(shape),
+                                                   static_cast<char>(0));
   return tensor;
 }
 
+template <>
+dm_env_rpc::v1::Tensor ZeroVector<int32_t>(int size) {
+  return ZeroTensor<int32_t>({size});
+}
+
+template <>
+dm_env_rpc::v1::Tensor ZeroMatrix<int32_t>(int y, int x) {
+  return ZeroTensor<int32_t>({y, x});
+}
+
+template <>
+dm_env_rpc::v1::Tensor ZeroMatrix<int64_t>(int y, int x) {
+  return ZeroTensor<int64_t>({y, x});
+}
+
 template <>
 dm_env_rpc::v1::Tensor ZeroMatrix<uint8_t>(int y, int x) {
-  dm_env_rpc::v1::Tensor tensor;
-  tensor.add_shape(y);
-  tensor.add_shape(x);
-  *tensor.mutable_uint8s()->mutable_array() =
-      std::string(y * x, static_cast<char>(0));
-  return tensor;
+  return ZeroTensor<uint8_t>({y, x});
 }
 
-int GetNumElements(const google::protobuf::RepeatedField<int32_t>& tensor_shape) {
-  int num_elements = 1;
-  for (auto s : tensor_shape) {
-    num_elements *= s;
-  }
-  return num_elements;
+template <>
+absl::Span<int32_t> MutableData<int32_t>(dm_env_rpc::v1::Tensor* tensor) {
+  CHECK_EQ(tensor->payload_case(), dm_env_rpc::v1::Tensor::kInt32S);
+  auto* array = tensor->mutable_int32s()->mutable_array();
+  return absl::MakeSpan(array->mutable_data(), array->size());
+}
+
+template <>
+absl::Span<int64_t> MutableData<int64_t>(dm_env_rpc::v1::Tensor* tensor) {
+  CHECK_EQ(tensor->payload_case(), dm_env_rpc::v1::Tensor::kInt64S);
+  auto* array = tensor->mutable_int64s()->mutable_array();
+  return absl::MakeSpan(array->mutable_data(), array->size());
+}
+
+template <>
+absl::Span<uint8_t> MutableData<uint8_t>(dm_env_rpc::v1::Tensor* tensor) {
+  CHECK_EQ(tensor->payload_case(), dm_env_rpc::v1::Tensor::kUint8S);
+  std::string* string = tensor->mutable_uint8s()->mutable_array();
+  return absl::MakeSpan(reinterpret_cast<uint8_t*>(string->data()),
+                        string->size());
+}
+
+template <>
+absl::Span<const int32_t> Data<int32_t>(const dm_env_rpc::v1::Tensor& tensor) {
+  CHECK_EQ(tensor.payload_case(), dm_env_rpc::v1::Tensor::kInt32S);
+  const auto& array = tensor.int32s().array();
+  return absl::MakeConstSpan(array.data(), array.size());
+}
+
+template <>
+absl::Span<const int64_t> Data<int64_t>(const dm_env_rpc::v1::Tensor& tensor) {
+  CHECK_EQ(tensor.payload_case(), dm_env_rpc::v1::Tensor::kInt64S);
+  const auto& array = tensor.int64s().array();
+  return absl::MakeConstSpan(array.data(), array.size());
+}
+
+template <>
+absl::Span<const uint8_t> Data<uint8_t>(const dm_env_rpc::v1::Tensor& tensor) {
+  CHECK_EQ(tensor.payload_case(), dm_env_rpc::v1::Tensor::kUint8S);
+  const std::string& string = tensor.uint8s().array();
+  return absl::MakeConstSpan(reinterpret_cast<const uint8_t*>(string.data()),
+                             string.size());
 }
 
 template <>
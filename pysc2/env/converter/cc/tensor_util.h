@@ -20,6 +20,7 @@
 #include "glog/logging.h"
 #include "google/protobuf/repeated_field.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 
 namespace pysc2 {
@@ -49,11 +50,22 @@ dm_env_rpc::v1::Tensor MakeTensor(int value);
 
 dm_env_rpc::v1::Tensor MakeTensor(const std::vector<int>& values);
 
+// Zero initialized tensors. The payload is allocated in a single step, so
+// writers should fill it through MutableData rather than by appending.
+template <typename T>
+dm_env_rpc::v1::Tensor ZeroTensor(const std::vector<int>& shape);
 template <typename T>
 dm_env_rpc::v1::Tensor ZeroVector(int size);
 template <typename T>
 dm_env_rpc::v1::Tensor ZeroMatrix(int y, int x);
 
+// Typed, flat (row-major) views of a tensor's payload. The payload must
+// already be of type T.
+template <typename T>
+absl::Span<T> MutableData(dm_env_rpc::v1::Tensor* tensor);
+template <typename T>
+absl::Span<const T> Data(const dm_env_rpc::v1::Tensor& tensor);
+
 template <typename T>
 void CheckTensor(const dm_env_rpc::v1::Tensor& tensor);
 
@@ -91,6 +103,15 @@ class Matrix {
     return value(j * width() + i);
   }
 
+  // Row j of the matrix. Only the row index is checked here; element access
+  // through the span is checked in debug builds only. Use operator() where
+  // every access should be checked.
+  absl::Span<const T> row(int j) const {
+    CHECK_GE(j, 0);
+    CHECK_LT(j, height());
+    return Data<T>(tensor_).subspan(j * width(), width());
+  }
+
   int height() const { return tensor_.shape(0); }
   int width() const { return tensor_.shape(1); }
 
@@ -113,6 +134,15 @@ class MutableMatrix {
     return value(j * width() + i);
   }
 
+  // Row j of the matrix. Only the row index is checked here; element access
+  // through the span is checked in debug builds only. Use operator() where
+  // every access should be checked.
+  absl::Span<T> row(int j) {
+    CHECK_GE(j, 0);
+    CHECK_LT(j, height());
+    return MutableData<T>(tensor_).subspan(j * width(), width());
+  }
+
   int height() const { return tensor_->shape(0); }
   int width() const { return tensor_->shape(1); }
 
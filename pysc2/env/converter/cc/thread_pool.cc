@@ -0,0 +1,98 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/thread_pool.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "glog/logging.h"
+#include "absl/synchronization/mutex.h"
+
+namespace pysc2 {
+
+ThreadPool::ThreadPool(int num_threads) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 1; i < num_threads; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock lock(&mu_);
+    stop_ = true;
+  }
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(int size, int chunk_size,
+                             const std::function<void(int, int)>& fn) {
+  CHECK_GT(chunk_size, 0);
+  const int num_chunks = (size + chunk_size - 1) / chunk_size;
+  if (workers_.empty() || num_chunks <= 1) {
+    for (int begin = 0; begin < size; begin += chunk_size) {
+      fn(begin, std::min(begin + chunk_size, size));
+    }
+    return;
+  }
+
+  {
+    absl::MutexLock lock(&mu_);
+    fn_ = &fn;
+    size_ = size;
+    chunk_size_ = chunk_size;
+    num_chunks_ = num_chunks;
+    next_chunk_.store(0, std::memory_order_relaxed);
+    pending_workers_ = workers_.size();
+  }
+  RunChunks();
+  // Every chunk has been claimed, so workers which haven't joined yet have
+  // nothing left to do. The ones which have finish their chunks first.
+  absl::MutexLock lock(&mu_);
+  pending_workers_ = 0;
+  mu_.Await(absl::Condition(this, &ThreadPool::Idle));
+  fn_ = nullptr;
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(this, &ThreadPool::HasWork));
+      if (stop_) {
+        return;
+      }
+      --pending_workers_;
+      ++busy_workers_;
+    }
+    RunChunks();
+    absl::MutexLock lock(&mu_);
+    --busy_workers_;
+  }
+}
+
+void ThreadPool::RunChunks() {
+  for (int chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+       chunk < num_chunks_;
+       chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed)) {
+    int begin = chunk * chunk_size_;
+    (*fn_)(begin, std::min(begin + chunk_size_, size_));
+  }
+}
+
+}  // namespace pysc2
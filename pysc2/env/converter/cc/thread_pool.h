@@ -0,0 +1,75 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYSC2_ENV_CONVERTER_CC_THREAD_POOL_H_
+#define PYSC2_ENV_CONVERTER_CC_THREAD_POOL_H_
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace pysc2 {
+
+// A fixed set of worker threads for splitting loops over index ranges. The
+// range is cut into chunks which the workers and the calling thread claim
+// one at a time, so that whoever is done first takes on the rest.
+class ThreadPool {
+ public:
+  // Starts `num_threads` - 1 workers, as the calling thread takes part too.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // The number of threads loops are run on, including the calling one.
+  int num_threads() const { return workers_.size() + 1; }
+
+  // Calls fn(begin, end) for consecutive chunks of at most `chunk_size` of
+  // [0, size), returning once all of them are done. Chunks may run in any
+  // order and at the same time, so `fn` must only touch state of its own
+  // chunk. Must not be called from more than one thread at a time.
+  void ParallelFor(int size, int chunk_size,
+                   const std::function<void(int, int)>& fn);
+
+ private:
+  void WorkerLoop();
+  // Runs chunks of the current loop until none are left.
+  void RunChunks();
+  bool HasWork() const { return stop_ || pending_workers_ > 0; }
+  bool Idle() const { return busy_workers_ == 0; }
+
+  std::vector<std::thread> workers_;
+
+  // The current loop, set before workers are let in.
+  const std::function<void(int, int)>* fn_ = nullptr;
+  int size_ = 0;
+  int chunk_size_ = 1;
+  int num_chunks_ = 0;
+  std::atomic<int> next_chunk_{0};
+
+  mutable absl::Mutex mu_;
+  // How many more workers may join the current loop, and how many are in it.
+  int pending_workers_ = 0;
+  int busy_workers_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace pysc2
+
+#endif  // PYSC2_ENV_CONVERTER_CC_THREAD_POOL_H_
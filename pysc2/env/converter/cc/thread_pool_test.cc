@@ -0,0 +1,49 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/thread_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace pysc2 {
+namespace {
+
+TEST(ThreadPoolTest, ParallelForCoversEveryIndexOnce) {
+  for (int num_threads : {1, 2, 5}) {
+    ThreadPool thread_pool(num_threads);
+    EXPECT_EQ(thread_pool.num_threads(), num_threads);
+    // The pool is reused across loops of different shapes.
+    for (int size : {0, 1, 7, 64, 1000}) {
+      for (int chunk_size : {1, 3, 64, 2000}) {
+        std::vector<std::atomic<int>> visits(size);
+        thread_pool.ParallelFor(size, chunk_size, [&](int begin, int end) {
+          ASSERT_LE(end - begin, chunk_size);
+          for (int i = begin; i < end; ++i) {
+            visits[i]++;
+          }
+        });
+        for (int i = 0; i < size; ++i) {
+          ASSERT_EQ(visits[i], 1) << size << ", " << chunk_size << ": " << i;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace pysc2
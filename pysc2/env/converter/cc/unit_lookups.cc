@@ -14,52 +14,53 @@
 
 #include "pysc2/env/converter/cc/unit_lookups.h"
 
+#include <algorithm>
+#include <array>
+
 #include "glog/logging.h"
-#include "absl/container/flat_hash_map.h"
 #include "pysc2/env/converter/cc/game_data/proto/units.pb.h"
 #include "s2clientprotocol/common.pb.h"
 
 namespace pysc2 {
 namespace {
 
-absl::flat_hash_map<uint32_t, SC2APIProtocol::Race>* UnitsToRace() {
-  absl::flat_hash_map<uint32_t, SC2APIProtocol::Race>* unit_to_race =
-      new absl::flat_hash_map<uint32_t, SC2APIProtocol::Race>();
-  for (int i = 0; i < Protoss_descriptor()->value_count(); ++i) {
-    auto u = Protoss_descriptor()->value(i)->number();
-    unit_to_race->try_emplace(u, SC2APIProtocol::Protoss);
-  }
+constexpr int kMaxUnitType =
+    std::max<int>({Protoss_MAX, Terran_MAX, Zerg_MAX, Neutral_MAX});
 
-  for (int i = 0; i < Terran_descriptor()->value_count(); ++i) {
-    auto u = Terran_descriptor()->value(i)->number();
-    unit_to_race->try_emplace(u, SC2APIProtocol::Terran);
-  }
+using RaceTable = std::array<SC2APIProtocol::Race, kMaxUnitType + 1>;
 
-  for (int i = 0; i < Zerg_descriptor()->value_count(); ++i) {
-    auto u = Zerg_descriptor()->value(i)->number();
-    unit_to_race->try_emplace(u, SC2APIProtocol::Zerg);
+// Where the races claim the same id, the first one added wins.
+void AddRace(const google::protobuf::EnumDescriptor* units,
+             SC2APIProtocol::Race race, RaceTable* table) {
+  for (int i = 0; i < units->value_count(); ++i) {
+    auto u = units->value(i)->number();
+    if ((*table)[u] == SC2APIProtocol::Random) {
+      (*table)[u] = race;
+    }
   }
-
-  for (int i = 0; i < Neutral_descriptor()->value_count(); ++i) {
-    auto u = Neutral_descriptor()->value(i)->number();
-    unit_to_race->try_emplace(u, SC2APIProtocol::NoRace);
-  }
-
-  return unit_to_race;
 }
 
-const absl::flat_hash_map<uint32_t, SC2APIProtocol::Race>& UnitToRaceMap() {
-  static const auto* const units_to_race = UnitsToRace();
+const RaceTable& UnitToRaceTable() {
+  static const auto* const units_to_race = [] {
+    auto* table = new RaceTable;
+    table->fill(SC2APIProtocol::Random);
+    AddRace(Protoss_descriptor(), SC2APIProtocol::Protoss, table);
+    AddRace(Terran_descriptor(), SC2APIProtocol::Terran, table);
+    AddRace(Zerg_descriptor(), SC2APIProtocol::Zerg, table);
+    AddRace(Neutral_descriptor(), SC2APIProtocol::NoRace, table);
+    return table;
+  }();
   return *units_to_race;
 }
 
 }  // namespace
 
 SC2APIProtocol::Race UnitTypeToRace(uint32_t unit_type) {
-  const auto& unit_to_race = UnitToRaceMap();
-  const auto it = unit_to_race.find(unit_type);
-  CHECK(it != unit_to_race.end()) << "Unknown unit type: " << unit_type;
-  return it->second;
+  const RaceTable& unit_to_race = UnitToRaceTable();
+  if (unit_type >= unit_to_race.size()) {
+    return SC2APIProtocol::Random;
+  }
+  return unit_to_race[unit_type];
 }
 
 std::string UnitTypeToString(uint32_t unit_type) {
@@ -18,11 +18,12 @@
 #include <cstdint>
 #include <string>
 
-#include "absl/container/flat_hash_map.h"
 #include "s2clientprotocol/common.pb.h"
 
 namespace pysc2 {
 
+// Returns Random for unit types that belong to no race, e.g. ones added by a
+// newer game build.
 SC2APIProtocol::Race UnitTypeToRace(uint32_t unit_type);
 
 std::string UnitTypeToString(uint32_t unit_type);
@@ -25,6 +25,7 @@ TEST(UnitLookupsTest, UnitTypeToRace) {
   EXPECT_EQ(UnitTypeToRace(Terran::Hellion), SC2APIProtocol::Terran);
   EXPECT_EQ(UnitTypeToRace(Zerg::Zergling), SC2APIProtocol::Zerg);
   EXPECT_EQ(UnitTypeToRace(Neutral::CarrionBird), SC2APIProtocol::NoRace);
+  EXPECT_EQ(UnitTypeToRace(100000), SC2APIProtocol::Random);
 }
 
 TEST(UnitLookupsTest, UnitTypeToString) {
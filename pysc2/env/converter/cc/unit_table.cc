@@ -0,0 +1,141 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/unit_table.h"
+
+#include <cstdint>
+#include <optional>
+
+#include "glog/logging.h"
+#include "absl/types/span.h"
+#include "s2clientprotocol/raw.pb.h"
+
+namespace pysc2 {
+
+UnitTable::UnitTable(int num_slots) : num_slots_(num_slots) {
+  CHECK_GT(num_slots, 0);
+  Clear();
+}
+
+UnitTable::UnitTable(const SC2APIProtocol::ObservationRaw& raw,
+                     uint32_t game_loop) {
+  Update(raw, game_loop);
+}
+
+void UnitTable::Update(const SC2APIProtocol::ObservationRaw& raw,
+                       uint32_t game_loop) {
+  tags_.swap(previous_tags_);
+  for (uint64_t tag : previous_tags_) {
+    entries_[tag].index = -1;
+  }
+  tags_.clear();
+  tags_.reserve(raw.units_size());
+  entries_.reserve(raw.units_size());
+  for (int i = 0; i < raw.units_size(); ++i) {
+    const SC2APIProtocol::Unit& u = raw.units(i);
+    tags_.push_back(u.tag());
+    Entry& entry =
+        entries_.try_emplace(u.tag(), Entry{-1, 0, 0, 0, -1}).first->second;
+    if (entry.index >= 0) {
+      continue;
+    }
+    entry.index = i;
+    entry.unit_type = u.unit_type();
+    entry.owner = u.owner();
+    entry.last_seen_game_loop = game_loop;
+  }
+  if (has_slots()) {
+    AssignSlots(previous_tags_);
+  }
+}
+
+void UnitTable::AssignSlots(absl::Span<const uint64_t> previous_tags) {
+  // Free the slots of the units which are gone before handing out any, so
+  // that they can be reused straight away.
+  for (uint64_t tag : previous_tags) {
+    Entry& entry = entries_[tag];
+    if (entry.index < 0 && entry.slot >= 0) {
+      slot_units_[entry.slot] = -1;
+      free_slots_.push(entry.slot);
+      entry.slot = -1;
+    }
+  }
+  unit_slots_.assign(tags_.size(), -1);
+  for (int i = 0; i < tags_.size(); ++i) {
+    Entry& entry = entries_[tags_[i]];
+    if (entry.index != i) {
+      // A duplicate of an earlier unit.
+      continue;
+    }
+    if (entry.slot < 0 && !free_slots_.empty()) {
+      entry.slot = free_slots_.top();
+      free_slots_.pop();
+    }
+    if (entry.slot >= 0) {
+      slot_units_[entry.slot] = i;
+      unit_slots_[i] = entry.slot;
+    }
+  }
+}
+
+void UnitTable::Clear() {
+  entries_.clear();
+  tags_.clear();
+  previous_tags_.clear();
+  unit_slots_.clear();
+  slot_units_.assign(num_slots_, -1);
+  free_slots_ = {};
+  for (int slot = 0; slot < num_slots_; ++slot) {
+    free_slots_.push(slot);
+  }
+}
+
+const UnitTable::Entry* UnitTable::Find(uint64_t tag) const {
+  auto it = entries_.find(tag);
+  return it == entries_.end() ? nullptr : &it->second;
+}
+
+const UnitTable::Entry* UnitTable::FindCurrent(uint64_t tag) const {
+  const Entry* entry = Find(tag);
+  return entry != nullptr && entry->index >= 0 ? entry : nullptr;
+}
+
+int UnitTable::IndexOf(uint64_t tag) const {
+  const Entry* entry = Find(tag);
+  return entry == nullptr ? -1 : entry->index;
+}
+
+int UnitTable::RowOf(uint64_t tag) const {
+  const Entry* entry = FindCurrent(tag);
+  if (entry == nullptr) {
+    return -1;
+  }
+  return has_slots() ? entry->slot : entry->index;
+}
+
+std::optional<uint64_t> UnitTable::TagAtRow(int row) const {
+  if (has_slots()) {
+    if (row < 0 || row >= num_slots_ || slot_units_[row] < 0) {
+      return std::nullopt;
+    }
+    return tags_[slot_units_[row]];
+  }
+  if (row < 0 || row >= tags_.size()) {
+    return std::nullopt;
+  }
+  return tags_[row];
+}
+
+}  // namespace pysc2
@@ -0,0 +1,109 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYSC2_ENV_CONVERTER_CC_UNIT_TABLE_H_
+#define PYSC2_ENV_CONVERTER_CC_UNIT_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+#include "s2clientprotocol/raw.pb.h"
+
+namespace pysc2 {
+
+// The units seen over an episode, keyed by tag. The table is updated in place
+// from each raw observation, so that looking units up by tag needs neither a
+// hash table built per call nor a scan over the observation's units.
+//
+// Optionally the table also assigns each observed unit a slot, which is the
+// unit's row in raw_units for as long as it is observed. Slots of units which
+// are no longer observed are reused, lowest first.
+class UnitTable {
+ public:
+  struct Entry {
+    // Index into the units of the latest observation, or -1 if the unit was
+    // not part of it.
+    int index;
+    int unit_type;
+    int owner;
+    uint32_t last_seen_game_loop;
+    // Slot of the unit while it is observed, or -1 if it has none.
+    int slot;
+  };
+
+  UnitTable() = default;
+  // A table which assigns up to `num_slots` slots.
+  explicit UnitTable(int num_slots);
+  // A table holding just the units of `raw`.
+  explicit UnitTable(const SC2APIProtocol::ObservationRaw& raw,
+                     uint32_t game_loop = 0);
+
+  // Makes `raw`, observed at `game_loop`, the latest observation. Units which
+  // appear more than once keep the index of their first appearance.
+  void Update(const SC2APIProtocol::ObservationRaw& raw, uint32_t game_loop);
+
+  // Forgets all units, e.g. at the start of an episode.
+  void Clear();
+
+  // Returns the entry for `tag`, or nullptr if the unit was never seen.
+  const Entry* Find(uint64_t tag) const;
+
+  // Returns the entry for `tag` if the unit is part of the latest
+  // observation, or nullptr otherwise.
+  const Entry* FindCurrent(uint64_t tag) const;
+
+  // Returns the index of `tag` in the latest observation, or -1.
+  int IndexOf(uint64_t tag) const;
+
+  // The tags of the latest observation's units, in observation order.
+  absl::Span<const uint64_t> tags() const { return tags_; }
+
+  bool has_slots() const { return num_slots_ > 0; }
+
+  // The slot of each of the latest observation's units, or -1 for units
+  // which didn't get one as all slots were taken. Empty without slots.
+  absl::Span<const int> unit_slots() const { return unit_slots_; }
+
+  // Returns the raw_units row of `tag`: its slot with slots and its index
+  // otherwise. Returns -1 if the unit has no row in the latest observation.
+  int RowOf(uint64_t tag) const;
+
+  // Returns the tag of the unit at raw_units row `row`, if any.
+  std::optional<uint64_t> TagAtRow(int row) const;
+
+  int size() const { return entries_.size(); }
+
+ private:
+  void AssignSlots(absl::Span<const uint64_t> previous_tags);
+
+  absl::flat_hash_map<uint64_t, Entry> entries_;
+  std::vector<uint64_t> tags_;
+  std::vector<uint64_t> previous_tags_;
+
+  int num_slots_ = 0;
+  // The index of the unit holding each slot, or -1.
+  std::vector<int> slot_units_;
+  std::vector<int> unit_slots_;
+  std::priority_queue<int, std::vector<int>, std::greater<int>> free_slots_;
+};
+
+}  // namespace pysc2
+
+#endif  // PYSC2_ENV_CONVERTER_CC_UNIT_TABLE_H_
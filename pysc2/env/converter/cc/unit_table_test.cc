@@ -0,0 +1,112 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pysc2/env/converter/cc/unit_table.h"
+
+#include <cstdint>
+#include <optional>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "s2clientprotocol/raw.pb.h"
+
+namespace pysc2 {
+namespace {
+
+void AddUnit(uint64_t tag, int unit_type, int owner,
+             SC2APIProtocol::ObservationRaw* raw) {
+  SC2APIProtocol::Unit* unit = raw->add_units();
+  unit->set_tag(tag);
+  unit->set_unit_type(unit_type);
+  unit->set_owner(owner);
+}
+
+TEST(UnitTableTest, IndexesTheLatestObservation) {
+  SC2APIProtocol::ObservationRaw first;
+  AddUnit(100, 48, 1, &first);
+  AddUnit(200, 105, 2, &first);
+  UnitTable table(first, 10);
+  EXPECT_EQ(table.IndexOf(100), 0);
+  EXPECT_EQ(table.IndexOf(200), 1);
+  EXPECT_EQ(table.IndexOf(300), -1);
+  EXPECT_EQ(table.Find(300), nullptr);
+
+  SC2APIProtocol::ObservationRaw second;
+  AddUnit(300, 21, 1, &second);
+  AddUnit(100, 49, 1, &second);
+  table.Update(second, 20);
+  EXPECT_EQ(table.size(), 3);
+  EXPECT_EQ(table.tags().size(), 2);
+  EXPECT_EQ(table.tags()[0], 300);
+  EXPECT_EQ(table.IndexOf(300), 0);
+  EXPECT_EQ(table.IndexOf(100), 1);
+  EXPECT_EQ(table.FindCurrent(100)->unit_type, 49);
+  EXPECT_EQ(table.FindCurrent(100)->last_seen_game_loop, 20);
+
+  // Units which are no longer observed keep what was last seen of them.
+  EXPECT_EQ(table.IndexOf(200), -1);
+  EXPECT_EQ(table.FindCurrent(200), nullptr);
+  const UnitTable::Entry* gone = table.Find(200);
+  ASSERT_NE(gone, nullptr);
+  EXPECT_EQ(gone->unit_type, 105);
+  EXPECT_EQ(gone->owner, 2);
+  EXPECT_EQ(gone->last_seen_game_loop, 10);
+
+  table.Clear();
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_EQ(table.Find(100), nullptr);
+}
+
+TEST(UnitTableTest, DuplicateTagsKeepTheFirstIndex) {
+  SC2APIProtocol::ObservationRaw raw;
+  AddUnit(100, 48, 1, &raw);
+  AddUnit(100, 49, 1, &raw);
+  UnitTable table(raw);
+  EXPECT_EQ(table.IndexOf(100), 0);
+  EXPECT_EQ(table.Find(100)->unit_type, 48);
+}
+
+TEST(UnitTableTest, SlotsAreKeptAndReused) {
+  UnitTable table(3);
+  SC2APIProtocol::ObservationRaw first;
+  AddUnit(100, 48, 1, &first);
+  AddUnit(200, 48, 1, &first);
+  AddUnit(300, 48, 1, &first);
+  AddUnit(400, 48, 1, &first);
+  table.Update(first, 1);
+  EXPECT_THAT(table.unit_slots(), testing::ElementsAre(0, 1, 2, -1));
+  EXPECT_EQ(table.RowOf(400), -1);
+
+  SC2APIProtocol::ObservationRaw second;
+  AddUnit(500, 48, 1, &second);
+  AddUnit(300, 48, 1, &second);
+  AddUnit(100, 48, 1, &second);
+  table.Update(second, 2);
+  EXPECT_THAT(table.unit_slots(), testing::ElementsAre(1, 2, 0));
+  EXPECT_EQ(table.RowOf(500), 1);
+  EXPECT_EQ(table.RowOf(200), -1);
+  EXPECT_EQ(table.TagAtRow(1), 500);
+  EXPECT_EQ(table.TagAtRow(2), 300);
+  EXPECT_EQ(table.TagAtRow(3), std::nullopt);
+
+  SC2APIProtocol::ObservationRaw third;
+  AddUnit(100, 48, 1, &third);
+  table.Update(third, 3);
+  EXPECT_THAT(table.unit_slots(), testing::ElementsAre(0));
+  EXPECT_EQ(table.TagAtRow(1), std::nullopt);
+}
+
+}  // namespace
+}  // namespace pysc2
@@ -0,0 +1,140 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pysc2/env/converter/cc/unpack_bits.h"
+
+#include <cstdint>
+
+#include "glog/logging.h"
+#include "absl/types/span.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace pysc2 {
+namespace {
+
+// Unpacks packed bytes from `begin` onwards into the matching part of
+// unpacked.
+void UnpackBitsTail(absl::Span<const uint8_t> packed, int begin,
+                    absl::Span<uint8_t> unpacked) {
+  for (int k = begin; k < packed.size(); ++k) {
+    uint8_t c = packed[k];
+    uint8_t* out = unpacked.data() + 8 * k;
+    for (int i = 0; i < 8; ++i) {
+      out[i] = (c >> (7 - i)) & 0x1;
+    }
+  }
+}
+
+using UnpackBitsFn = void (*)(absl::Span<const uint8_t>, absl::Span<uint8_t>);
+
+UnpackBitsFn SelectUnpackBits() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuSupportsAvx2()) {
+    return UnpackBitsAvx2;
+  }
+  if (CpuSupportsSse2()) {
+    return UnpackBitsSse2;
+  }
+#endif
+  return UnpackBitsScalar;
+}
+
+}  // namespace
+
+void UnpackBits(absl::Span<const uint8_t> packed,
+                absl::Span<uint8_t> unpacked) {
+  static const UnpackBitsFn unpack_bits = SelectUnpackBits();
+  CHECK_EQ(unpacked.size(), 8 * packed.size());
+  unpack_bits(packed, unpacked);
+}
+
+void UnpackBitsScalar(absl::Span<const uint8_t> packed,
+                      absl::Span<uint8_t> unpacked) {
+  CHECK_EQ(unpacked.size(), 8 * packed.size());
+  UnpackBitsTail(packed, 0, unpacked);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+bool CpuSupportsSse2() { return __builtin_cpu_supports("sse2"); }
+
+bool CpuSupportsAvx2() { return __builtin_cpu_supports("avx2"); }
+
+// 8 packed bytes per iteration: each byte is broadcast to 8 lanes and tested
+// against a per-lane bit mask.
+__attribute__((target("sse2"))) void UnpackBitsSse2(
+    absl::Span<const uint8_t> packed, absl::Span<uint8_t> unpacked) {
+  CHECK_EQ(unpacked.size(), 8 * packed.size());
+  const __m128i bits = _mm_setr_epi8(
+      static_cast<char>(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+      static_cast<char>(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+  const __m128i ones = _mm_set1_epi8(1);
+  int k = 0;
+  for (; k + 8 <= packed.size(); k += 8) {
+    __m128i v = _mm_loadl_epi64(
+        reinterpret_cast<const __m128i*>(packed.data() + k));
+    v = _mm_unpacklo_epi8(v, v);                    // b0 b0 b1 b1 .. b7 b7
+    __m128i lo = _mm_unpacklo_epi16(v, v);          // b0 x4 .. b3 x4
+    __m128i hi = _mm_unpackhi_epi16(v, v);          // b4 x4 .. b7 x4
+    __m128i out[4] = {_mm_unpacklo_epi32(lo, lo),   // b0 x8, b1 x8
+                      _mm_unpackhi_epi32(lo, lo),   // b2 x8, b3 x8
+                      _mm_unpacklo_epi32(hi, hi),   // b4 x8, b5 x8
+                      _mm_unpackhi_epi32(hi, hi)};  // b6 x8, b7 x8
+    for (int i = 0; i < 4; ++i) {
+      __m128i set = _mm_cmpeq_epi8(_mm_and_si128(out[i], bits), bits);
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(unpacked.data() + 8 * k + 16 * i),
+          _mm_and_si128(set, ones));
+    }
+  }
+  UnpackBitsTail(packed, k, unpacked);
+}
+
+// 16 packed bytes per iteration: 4 bytes at a time are shuffled out to 8
+// lanes each and tested against a per-lane bit mask.
+__attribute__((target("avx2"))) void UnpackBitsAvx2(
+    absl::Span<const uint8_t> packed, absl::Span<uint8_t> unpacked) {
+  CHECK_EQ(unpacked.size(), 8 * packed.size());
+  const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+  const __m256i ones = _mm256_set1_epi8(1);
+  // The shuffle works within 128-bit lanes, so the low lane expands bytes
+  // 4i and 4i + 1 and the high lane bytes 4i + 2 and 4i + 3.
+  __m256i shuffles[4];
+  for (int i = 0; i < 4; ++i) {
+    shuffles[i] = _mm256_setr_epi64x(0x0101010101010101 * (4 * i),
+                                     0x0101010101010101 * (4 * i + 1),
+                                     0x0101010101010101 * (4 * i + 2),
+                                     0x0101010101010101 * (4 * i + 3));
+  }
+  int k = 0;
+  for (; k + 16 <= packed.size(); k += 16) {
+    __m256i v = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed.data() + k)));
+    for (int i = 0; i < 4; ++i) {
+      __m256i bytes = _mm256_shuffle_epi8(v, shuffles[i]);
+      __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i*>(unpacked.data() + 8 * k + 32 * i),
+          _mm256_and_si256(set, ones));
+    }
+  }
+  UnpackBitsTail(packed, k, unpacked);
+}
+
+#endif
+
+}  // namespace pysc2
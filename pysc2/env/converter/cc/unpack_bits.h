@@ -0,0 +1,45 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSC2_ENV_CONVERTER_CC_UNPACK_BITS_H_
+#define PYSC2_ENV_CONVERTER_CC_UNPACK_BITS_H_
+
+#include <cstdint>
+
+#include "absl/types/span.h"
+
+namespace pysc2 {
+
+// Expands every bit of `packed`, most significant bit first, into a byte of
+// `unpacked` holding 0 or 1. `unpacked` must be 8 times the size of `packed`.
+// Uses the widest kernel the CPU supports.
+void UnpackBits(absl::Span<const uint8_t> packed, absl::Span<uint8_t> unpacked);
+
+// The individual kernels, exposed for testing. The SIMD ones are only
+// compiled for x86 and must only be called when the CPU supports them.
+void UnpackBitsScalar(absl::Span<const uint8_t> packed,
+                      absl::Span<uint8_t> unpacked);
+
+#if defined(__x86_64__) || defined(__i386__)
+void UnpackBitsSse2(absl::Span<const uint8_t> packed,
+                    absl::Span<uint8_t> unpacked);
+void UnpackBitsAvx2(absl::Span<const uint8_t> packed,
+                    absl::Span<uint8_t> unpacked);
+bool CpuSupportsSse2();
+bool CpuSupportsAvx2();
+#endif
+
+}  // namespace pysc2
+
+#endif  // PYSC2_ENV_CONVERTER_CC_UNPACK_BITS_H_
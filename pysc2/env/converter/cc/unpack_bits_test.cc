@@ -0,0 +1,108 @@
+// Copyright 2021 DeepMind Technologies Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pysc2/env/converter/cc/unpack_bits.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/encode_image_data.h"
+#include "pysc2/env/converter/cc/tensor_util.h"
+#include "s2clientprotocol/common.pb.h"
+
+namespace pysc2 {
+namespace {
+
+using UnpackBitsFn = void (*)(absl::Span<const uint8_t>, absl::Span<uint8_t>);
+
+std::vector<uint8_t> RandomBytes(int size, std::mt19937* rng) {
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<uint8_t> bytes(size);
+  for (uint8_t& b : bytes) {
+    b = dist(*rng);
+  }
+  return bytes;
+}
+
+// Checks `unpack` against the scalar kernel for every length up to a few
+// SIMD blocks, so each kernel's main loop and tail are both covered.
+void ExpectMatchesScalar(UnpackBitsFn unpack) {
+  std::mt19937 rng(42);
+  for (int size = 0; size <= 67; ++size) {
+    std::vector<uint8_t> packed = RandomBytes(size, &rng);
+    std::vector<uint8_t> expected(8 * size);
+    std::vector<uint8_t> actual(8 * size, 0xff);
+    UnpackBitsScalar(packed, absl::MakeSpan(expected));
+    unpack(packed, absl::MakeSpan(actual));
+    EXPECT_EQ(actual, expected) << "size " << size;
+  }
+}
+
+TEST(UnpackBitsTest, ScalarIsMostSignificantBitFirst) {
+  std::vector<uint8_t> packed = {0x80, 0x01, 0xa5};
+  std::vector<uint8_t> unpacked(24);
+  UnpackBitsScalar(packed, absl::MakeSpan(unpacked));
+  EXPECT_EQ(unpacked, std::vector<uint8_t>({1, 0, 0, 0, 0, 0, 0, 0,  //
+                                            0, 0, 0, 0, 0, 0, 0, 1,  //
+                                            1, 0, 1, 0, 0, 1, 0, 1}));
+}
+
+TEST(UnpackBitsTest, DispatchedMatchesScalar) {
+  ExpectMatchesScalar(UnpackBits);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+TEST(UnpackBitsTest, Sse2MatchesScalar) {
+  if (!CpuSupportsSse2()) {
+    GTEST_SKIP() << "SSE2 not supported";
+  }
+  ExpectMatchesScalar(UnpackBitsSse2);
+}
+
+TEST(UnpackBitsTest, Avx2MatchesScalar) {
+  if (!CpuSupportsAvx2()) {
+    GTEST_SKIP() << "AVX2 not supported";
+  }
+  ExpectMatchesScalar(UnpackBitsAvx2);
+}
+#endif
+
+TEST(UnpackBitsTest, EncodeImageData1BitMatchesGenericPath) {
+  std::mt19937 rng(7);
+  SC2APIProtocol::ImageData image;
+  image.mutable_size()->set_x(64);
+  image.mutable_size()->set_y(48);
+  image.set_bits_per_pixel(1);
+  std::vector<uint8_t> packed = RandomBytes(64 * 48 / 8, &rng);
+  image.set_data(packed.data(), packed.size());
+
+  dm_env_rpc::v1::Tensor uint8_output = ZeroMatrix<uint8_t>(64, 48);
+  EncodeImageData<uint8_t>(image, nullptr, &uint8_output);
+  dm_env_rpc::v1::Tensor int32_output = ZeroMatrix<int32_t>(64, 48);
+  EncodeImageData<int32_t>(image, nullptr, &int32_output);
+
+  Matrix<uint8_t> actual(uint8_output);
+  Matrix<int32_t> expected(int32_output);
+  for (int j = 0; j < 64; ++j) {
+    for (int i = 0; i < 48; ++i) {
+      ASSERT_EQ(actual(j, i), expected(j, i)) << j << ", " << i;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace pysc2
@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <functional>
 #include <utility>
+#include <vector>
 
 #include "glog/logging.h"
 #include "absl/strings/str_cat.h"
@@ -88,12 +89,10 @@ const VisualActions& GetActions() {
   return *kActions;
 }  // NOLINT(readability/fn_size)
 
-int Val(const dm_env_rpc::v1::Tensor& tensor) { return ToScalar(tensor); }
-
-int Option(const dm_env_rpc::v1::Tensor& arg) {
+int Option(int arg) {
   // In proto these are 1-based, in python 0-based (with a lookup which maps
   // them back to 1-based). Hence in C++ we need to add 1.
-  return Val(arg) + 1;
+  return arg + 1;
 }
 
 SC2APIProtocol::PointI MakePoint(int arg, int width) {
@@ -107,61 +106,45 @@ int PointTo1D(const SC2APIProtocol::PointI& point, int width) {
   return point.y() * width + point.x();
 }
 
-const dm_env_rpc::v1::Tensor& Arg(
-    absl::string_view name,
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    absl::string_view context) {
-  auto arg = arguments.find(name);
-  CHECK(arg != arguments.cend())
-      << name << " is required for the " << context << " action";
-  return arg->second;
-}
-
-SC2APIProtocol::Action MoveCamera(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "move camera";
+SC2APIProtocol::Action MoveCamera(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   *action.mutable_action_feature_layer()
        ->mutable_camera_move()
-       ->mutable_center_minimap() = MakePoint(
-      Val(Arg("minimap", arguments, ctx)), action_context.minimap_width);
+       ->mutable_center_minimap() =
+      MakePoint(args.minimap, action_context.minimap_width);
 
   return action;
 }
 
-SC2APIProtocol::Action SelectPoint(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select_point";
+SC2APIProtocol::Action SelectPoint(const VisualActionArgs& args,
+                                   const ActionContext& action_context,
+                                   AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionSpatialUnitSelectionPoint* unit_selection_point =
       action.mutable_action_feature_layer()->mutable_unit_selection_point();
 
   unit_selection_point->set_type(
       SC2APIProtocol::ActionSpatialUnitSelectionPoint::Type(
-          Option(Arg("select_point_act", arguments, ctx))));
-  *unit_selection_point->mutable_selection_screen_coord() = MakePoint(
-      Val(Arg("screen", arguments, ctx)), action_context.screen_width);
+          Option(args.select_point_act)));
+  *unit_selection_point->mutable_selection_screen_coord() =
+      MakePoint(args.screen, action_context.screen_width);
   return action;
 }
 
-SC2APIProtocol::Action SelectRect(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select rect";
+SC2APIProtocol::Action SelectRect(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionSpatialUnitSelectionRect* unit_selection_rect =
       action.mutable_action_feature_layer()->mutable_unit_selection_rect();
   SC2APIProtocol::RectangleI* rect =
       unit_selection_rect->add_selection_screen_coord();
 
-  unit_selection_rect->set_selection_add(
-      static_cast<bool>(Val(Arg("select_add", arguments, ctx))));
-  auto s = MakePoint(Val(Arg("screen", arguments, ctx)),
-                     action_context.screen_width);
-  auto s2 = MakePoint(Val(Arg("screen2", arguments, ctx)),
-                      action_context.screen_width);
+  unit_selection_rect->set_selection_add(static_cast<bool>(args.select_add));
+  auto s = MakePoint(args.screen, action_context.screen_width);
+  auto s2 = MakePoint(args.screen2, action_context.screen_width);
   rect->mutable_p0()->set_x(std::min(s.x(), s2.x()));
   rect->mutable_p0()->set_y(std::min(s.y(), s2.y()));
   rect->mutable_p1()->set_x(std::max(s.x(), s2.x()));
@@ -169,148 +152,210 @@ SC2APIProtocol::Action SelectRect(
   return action;
 }
 
-SC2APIProtocol::Action SelectIdleWorker(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select idle worker";
+SC2APIProtocol::Action SelectIdleWorker(const VisualActionArgs& args,
+                                        const ActionContext& action_context,
+                                        AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_select_idle_worker()->set_type(
       SC2APIProtocol::ActionSelectIdleWorker::Type(
-          Option(Arg("select_worker", arguments, ctx))));
+          Option(args.select_worker)));
   return action;
 }
 
-SC2APIProtocol::Action SelectArmy(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select army";
+SC2APIProtocol::Action SelectArmy(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_select_army()->set_selection_add(
-      static_cast<bool>(Val(Arg("select_add", arguments, ctx))));
+      static_cast<bool>(args.select_add));
   return action;
 }
 
-SC2APIProtocol::Action SelectWarpGates(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select warp gates";
+SC2APIProtocol::Action SelectWarpGates(const VisualActionArgs& args,
+                                       const ActionContext& action_context,
+                                       AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_select_warp_gates()->set_selection_add(
-      static_cast<bool>(Val(Arg("select_add", arguments, ctx))));
+      static_cast<bool>(args.select_add));
   return action;
 }
 
-SC2APIProtocol::Action SelectLarva(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
+SC2APIProtocol::Action SelectLarva(const VisualActionArgs& args,
+                                   const ActionContext& action_context,
+                                   AbilityId ability_id) {
   SC2APIProtocol::Action action;
   *action.mutable_action_ui()->mutable_select_larva() =
       SC2APIProtocol::ActionSelectLarva();
   return action;
 }
 
-SC2APIProtocol::Action SelectUnit(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select unit";
+SC2APIProtocol::Action SelectUnit(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionMultiPanel* multi_panel =
       action.mutable_action_ui()->mutable_multi_panel();
 
-  multi_panel->set_type(SC2APIProtocol::ActionMultiPanel::Type(
-      Option(Arg("select_unit_act", arguments, ctx))));
-  multi_panel->set_unit_index(Val(Arg("select_unit_id", arguments, ctx)));
+  multi_panel->set_type(
+      SC2APIProtocol::ActionMultiPanel::Type(Option(args.select_unit_act)));
+  multi_panel->set_unit_index(args.select_unit_id);
   return action;
 }
 
-SC2APIProtocol::Action SelectControlGroup(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "select control group";
+SC2APIProtocol::Action SelectControlGroup(const VisualActionArgs& args,
+                                          const ActionContext& action_context,
+                                          AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionControlGroup* control_group =
       action.mutable_action_ui()->mutable_control_group();
 
   control_group->set_action(
       SC2APIProtocol::ActionControlGroup::ControlGroupAction(
-          Option(Arg("control_group_act", arguments, ctx))));
-  control_group->set_control_group_index(
-      Val(Arg("control_group_id", arguments, ctx)));
+          Option(args.control_group_act)));
+  control_group->set_control_group_index(args.control_group_id);
   return action;
 }
 
-SC2APIProtocol::Action Unload(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "unload";
+SC2APIProtocol::Action Unload(const VisualActionArgs& args,
+                              const ActionContext& action_context,
+                              AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_cargo_panel()->set_unit_index(
-      Val(Arg("unload_id", arguments, ctx)));
+      args.unload_id);
   return action;
 }
 
-SC2APIProtocol::Action BuildQueue(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "build queue";
+SC2APIProtocol::Action BuildQueue(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_production_panel()->set_unit_index(
-      Val(Arg("build_queue_id", arguments, ctx)));
+      args.build_queue_id);
   return action;
 }
 
-SC2APIProtocol::Action CmdQuick(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "cmd quick";
+SC2APIProtocol::Action CmdQuick(const VisualActionArgs& args,
+                                const ActionContext& action_context,
+                                AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionSpatialUnitCommand* command =
       action.mutable_action_feature_layer()->mutable_unit_command();
-  command->set_queue_command(
-      static_cast<bool>(Val(Arg("queued", arguments, ctx))));
+  command->set_queue_command(static_cast<bool>(args.queued));
   command->set_ability_id(ability_id);
   return action;
 }
 
-SC2APIProtocol::Action CmdScreen(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "cmd screen";
+SC2APIProtocol::Action CmdScreen(const VisualActionArgs& args,
+                                 const ActionContext& action_context,
+                                 AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionSpatialUnitCommand* command =
       action.mutable_action_feature_layer()->mutable_unit_command();
-  command->set_queue_command(
-      static_cast<bool>(Val(Arg("queued", arguments, ctx))));
+  command->set_queue_command(static_cast<bool>(args.queued));
   command->set_ability_id(ability_id);
-  *command->mutable_target_screen_coord() = MakePoint(
-      Val(Arg("screen", arguments, ctx)), action_context.screen_width);
+  *command->mutable_target_screen_coord() =
+      MakePoint(args.screen, action_context.screen_width);
   return action;
 }
 
-SC2APIProtocol::Action CmdMinimap(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
-  absl::string_view ctx = "cmd minimap";
+SC2APIProtocol::Action CmdMinimap(const VisualActionArgs& args,
+                                  const ActionContext& action_context,
+                                  AbilityId ability_id) {
   SC2APIProtocol::Action action;
   SC2APIProtocol::ActionSpatialUnitCommand* command =
       action.mutable_action_feature_layer()->mutable_unit_command();
-  command->set_queue_command(
-      static_cast<bool>(Val(Arg("queued", arguments, ctx))));
+  command->set_queue_command(static_cast<bool>(args.queued));
   command->set_ability_id(ability_id);
-  *command->mutable_target_minimap_coord() = MakePoint(
-      Val(Arg("minimap", arguments, ctx)), action_context.minimap_width);
+  *command->mutable_target_minimap_coord() =
+      MakePoint(args.minimap, action_context.minimap_width);
   return action;
 }
 
-SC2APIProtocol::Action Autocast(
-    const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& arguments,
-    const ActionContext& action_context, AbilityId ability_id) {
+SC2APIProtocol::Action Autocast(const VisualActionArgs& args,
+                                const ActionContext& action_context,
+                                AbilityId ability_id) {
   SC2APIProtocol::Action action;
   action.mutable_action_ui()->mutable_toggle_autocast()->set_ability_id(
       ability_id);
   return action;
 }
 
+using EncodeFn = SC2APIProtocol::Action (*)(const VisualActionArgs&,
+                                            const ActionContext&, AbilityId);
+
+// An argument of VisualActionArgs, by its name in the ActionSpec.
+struct NamedArg {
+  absl::string_view name;
+  int VisualActionArgs::*field;
+};
+
+// How to encode actions of one function type.
+struct Encoder {
+  EncodeFn fn;
+  // Describes the function type in errors.
+  absl::string_view context;
+  // The arguments which fn reads.
+  std::vector<NamedArg> args;
+};
+
+const Encoder& GetEncoder(FunctionType action_type) {
+  using Args = VisualActionArgs;
+  static const auto* encoders = new absl::flat_hash_map<FunctionType, Encoder>(
+      {{move_camera,
+        {MoveCamera, "move camera", {{"minimap", &Args::minimap}}}},
+       {select_point,
+        {SelectPoint,
+         "select_point",
+         {{"select_point_act", &Args::select_point_act},
+          {"screen", &Args::screen}}}},
+       {select_rect,
+        {SelectRect,
+         "select rect",
+         {{"select_add", &Args::select_add},
+          {"screen", &Args::screen},
+          {"screen2", &Args::screen2}}}},
+       {select_control_group,
+        {SelectControlGroup,
+         "select control group",
+         {{"control_group_act", &Args::control_group_act},
+          {"control_group_id", &Args::control_group_id}}}},
+       {select_unit,
+        {SelectUnit,
+         "select unit",
+         {{"select_unit_act", &Args::select_unit_act},
+          {"select_unit_id", &Args::select_unit_id}}}},
+       {select_idle_worker,
+        {SelectIdleWorker,
+         "select idle worker",
+         {{"select_worker", &Args::select_worker}}}},
+       {select_army,
+        {SelectArmy, "select army", {{"select_add", &Args::select_add}}}},
+       {select_warp_gates,
+        {SelectWarpGates,
+         "select warp gates",
+         {{"select_add", &Args::select_add}}}},
+       {select_larva, {SelectLarva, "select larva", {}}},
+       {unload, {Unload, "unload", {{"unload_id", &Args::unload_id}}}},
+       {build_queue,
+        {BuildQueue,
+         "build queue",
+         {{"build_queue_id", &Args::build_queue_id}}}},
+       {cmd_screen,
+        {CmdScreen,
+         "cmd screen",
+         {{"queued", &Args::queued}, {"screen", &Args::screen}}}},
+       {cmd_minimap,
+        {CmdMinimap,
+         "cmd minimap",
+         {{"queued", &Args::queued}, {"minimap", &Args::minimap}}}},
+       {cmd_quick, {CmdQuick, "cmd quick", {{"queued", &Args::queued}}}},
+       {autocast, {Autocast, "autocast", {}}}});
+  auto it = encoders->find(action_type);
+  CHECK(it != encoders->end()) << "No encoder for function type "
+                               << action_type;
+  return it->second;
+}
+
 absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> MakeFunctionCall(
     ActionId action_id, const absl::flat_hash_map<std::string, int>& args) {
   absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> fn_call;
@@ -406,28 +451,22 @@ SC2APIProtocol::Action VisualAction::Encode(
     const ActionContext& action_context) const {
   CHECK_NE(action_type_, no_op) << "Don't call Encode() for no_op";
 
-  static const auto* fn_map = new absl::flat_hash_map<
-      FunctionType,
-      std::function<SC2APIProtocol::Action(
-          const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>&,
-          const ActionContext&, AbilityId)>>(
-      {{move_camera, MoveCamera},
-       {select_point, SelectPoint},
-       {select_rect, SelectRect},
-       {select_control_group, SelectControlGroup},
-       {select_unit, SelectUnit},
-       {select_idle_worker, SelectIdleWorker},
-       {select_army, SelectArmy},
-       {select_warp_gates, SelectWarpGates},
-       {select_larva, SelectLarva},
-       {unload, Unload},
-       {build_queue, BuildQueue},
-       {cmd_screen, CmdScreen},
-       {cmd_minimap, CmdMinimap},
-       {cmd_quick, CmdQuick},
-       {autocast, Autocast}});
-
-  return fn_map->find(action_type_)->second(args, action_context, ability_id_);
+  const Encoder& encoder = GetEncoder(action_type_);
+  VisualActionArgs typed_args;
+  for (const NamedArg& arg : encoder.args) {
+    auto it = args.find(arg.name);
+    CHECK(it != args.cend())
+        << arg.name << " is required for the " << encoder.context << " action";
+    typed_args.*arg.field = ToScalar(it->second);
+  }
+  return encoder.fn(typed_args, action_context, ability_id_);
+}
+
+SC2APIProtocol::Action VisualAction::Encode(
+    const VisualActionArgs& args, const ActionContext& action_context) const {
+  CHECK_NE(action_type_, no_op) << "Don't call Encode() for no_op";
+
+  return GetEncoder(action_type_).fn(args, action_context, ability_id_);
 }
 
 const VisualAction& GetAction(ActionId action_id) {
@@ -35,6 +35,24 @@ struct ActionContext {
   int num_functions;
 };
 
+// The arguments of a visual action, as the ints of the ActionSpec. Only those
+// used by the function are read.
+struct VisualActionArgs {
+  int screen = 0;
+  int screen2 = 0;
+  int minimap = 0;
+  int queued = 0;
+  int control_group_act = 0;
+  int control_group_id = 0;
+  int select_point_act = 0;
+  int select_add = 0;
+  int select_unit_act = 0;
+  int select_unit_id = 0;
+  int select_worker = 0;
+  int build_queue_id = 0;
+  int unload_id = 0;
+};
+
 class VisualAction {
  public:
   VisualAction(ActionId action_id, absl::string_view tag,
@@ -53,6 +71,10 @@ class VisualAction {
       const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& args,
       const ActionContext& action_context) const;
 
+  // As above, for arguments which are already unpacked from their tensors.
+  SC2APIProtocol::Action Encode(const VisualActionArgs& args,
+                                const ActionContext& action_context) const;
+
  private:
   std::string tag_;
   FunctionType action_type_;
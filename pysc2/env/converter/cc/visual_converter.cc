@@ -14,9 +14,11 @@
 
 #include "pysc2/env/converter/cc/visual_converter.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
@@ -111,7 +113,16 @@ dm_env_rpc::v1::Tensor AvailableActions(const SC2APIProtocol::Observation& obs,
 }  // namespace
 
 VisualConverter::VisualConverter(const ConverterSettings& settings)
-    : settings_(settings), screen_field_indices_() {}
+    : settings_(settings),
+      observation_layout_(ObservationSpec()),
+      slots_(ResolveSlots(observation_layout_)) {
+  const auto& screen_features = settings_.visual_settings().screen_features();
+  if (!screen_features.empty()) {
+    screen_layers_ = FeatureLayerAccessors<SC2APIProtocol::FeatureLayers>(
+        std::vector<std::string>(screen_features.cbegin(),
+                                 screen_features.cend()));
+  }
+}
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
 VisualConverter::ObservationSpec() const {
@@ -122,13 +133,26 @@ VisualConverter::ObservationSpec() const {
 
   const auto& visual = settings_.visual_settings();
   const auto& screen_features = visual.screen_features();
-  for (size_t i = 0; i < screen_features.size(); ++i) {
-    const std::string& feature = screen_features[i];
-    auto name = absl::StrCat("screen_", feature);
-    auto range = GetScreenFeatureScale(feature).value();
-    spec[name] =
-        TensorSpec(name, dm_env_rpc::v1::DataType::UINT8,
-                   {visual.screen().x(), visual.screen().y()}, 0, range - 1);
+  if (settings_.stack_feature_layers()) {
+    if (!screen_features.empty()) {
+      int max_range = 0;
+      for (const std::string& feature : screen_features) {
+        max_range = std::max(max_range, GetScreenFeatureScale(feature).value());
+      }
+      spec["screen_stack"] = TensorSpec(
+          "screen_stack", dm_env_rpc::v1::DataType::UINT8,
+          {screen_features.size(), visual.screen().x(), visual.screen().y()},
+          0, max_range - 1);
+    }
+  } else {
+    for (size_t i = 0; i < screen_features.size(); ++i) {
+      const std::string& feature = screen_features[i];
+      auto name = absl::StrCat("screen_", feature);
+      auto range = GetScreenFeatureScale(feature).value();
+      spec[name] =
+          TensorSpec(name, dm_env_rpc::v1::DataType::UINT8,
+                     {visual.screen().x(), visual.screen().y()}, 0, range - 1);
+    }
   }
 
   if (settings_.supervised()) {
@@ -141,29 +165,54 @@ VisualConverter::ObservationSpec() const {
   return spec;
 }
 
+VisualConverter::Slots VisualConverter::ResolveSlots(
+    const ObservationLayout& layout) const {
+  Slots slots;
+  slots.available_actions = layout.Slot("available_actions");
+  slots.screen_stack = layout.Slot("screen_stack");
+  for (const std::string& feature :
+       settings_.visual_settings().screen_features()) {
+    slots.screen_layers.push_back(
+        layout.Slot(absl::StrCat("screen_", feature)));
+  }
+  if (settings_.supervised()) {
+    for (const auto& [k, v] : ActionSpec()) {
+      slots.actions.emplace_back(k, layout.Slot(absl::StrCat("action/", k)));
+    }
+  }
+  return slots;
+}
+
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 VisualConverter::ConvertObservation(const Observation& observation) {
-  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> output;
+  ObservationSlots output(observation_layout_);
+  absl::Status status = ConvertObservation(observation, slots_, &output);
+  if (!status.ok()) {
+    return status;
+  }
+  return output.MoveToMap(observation_layout_);
+}
 
+absl::Status VisualConverter::ConvertObservation(
+    const Observation& observation, const Slots& slots,
+    ObservationSlots* output) {
   const SC2APIProtocol::Observation& obs = observation.player().observation();
   const auto& visual = settings_.visual_settings();
-  output["available_actions"] =
-      AvailableActions(obs, settings_.num_action_types());
+  output->Set(slots.available_actions,
+              AvailableActions(obs, settings_.num_action_types()));
 
   const auto& screen_features = visual.screen_features();
   if (!screen_features.empty()) {
     const SC2APIProtocol::FeatureLayers& layers =
         obs.feature_layer_data().renders();
-    if (screen_field_indices_.empty()) {
-      screen_field_indices_ = FeatureLayerFieldIndices(
-          std::vector<std::string>(screen_features.cbegin(),
-                                   screen_features.cend()),
-          layers);
-    }
-
-    for (size_t i = 0; i < screen_features.size(); ++i) {
-      output[absl::StrCat("screen_", screen_features.at(i))] = FeatureLayer8bit(
-          layers, screen_field_indices_[i], screen_features.at(i));
+    if (settings_.stack_feature_layers()) {
+      output->Set(slots.screen_stack,
+                  FeatureLayerStack8bit(layers, screen_layers_));
+    } else {
+      for (size_t i = 0; i < screen_features.size(); ++i) {
+        output->Set(slots.screen_layers[i],
+                    FeatureLayer8bit(layers, screen_layers_[i]));
+      }
     }
   }
 
@@ -189,20 +238,22 @@ VisualConverter::ConvertObservation(const Observation& observation) {
           "`function` must be < num_action_types, instead was ", func_id));
     }
 
-    for (const auto& [k, v] : action) {
-      output[absl::StrCat("action/", k)] = v;
+    for (const auto& [k, slot] : slots.actions) {
+      if (auto it = action.find(k); it != action.end()) {
+        output->Set(slot, it->second);
+      }
     }
 
-    const auto& available_actions =
-        output.at("available_actions").int32s().array();
-    if (available_actions.Get(func_id) != 1) {
+    dm_env_rpc::v1::Tensor* available_actions =
+        output->Mutable(slots.available_actions);
+    if (available_actions->int32s().array(func_id) != 1) {
       LOG(INFO) << "Action " << func_id << " was not found among available "
                 << "ones! Marking as available.";
-      *output["available_actions"].mutable_int32s()->mutable_array()->Mutable(
-          func_id) = 1;
+      *available_actions->mutable_int32s()->mutable_array()->Mutable(func_id) =
+          1;
     }
   }
-  return output;
+  return absl::OkStatus();
 }
 
 absl::flat_hash_map<std::string, dm_env_rpc::v1::TensorSpec>
@@ -267,6 +318,21 @@ absl::StatusOr<SC2APIProtocol::RequestAction> VisualConverter::ConvertAction(
   return request_action;
 }
 
+absl::StatusOr<SC2APIProtocol::RequestAction> VisualConverter::ConvertAction(
+    int function, const VisualActionArgs& args) {
+  SC2APIProtocol::RequestAction request_action;
+  const VisualAction& func = GetAction(function);
+  if (func.action_type() == no_op) {
+    return request_action;
+  }
+
+  ActionContext action_context = {settings_.visual_settings().screen().x(),
+                                  settings_.minimap().x(),
+                                  settings_.num_action_types()};
+  *request_action.add_actions() = func.Encode(args, action_context);
+  return request_action;
+}
+
 absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
 VisualConverter::DecodeAction(
     const SC2APIProtocol::RequestAction& action) const {
@@ -17,13 +17,19 @@
 
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
+#include "pysc2/env/converter/cc/convert_obs.h"
+#include "pysc2/env/converter/cc/observation_slots.h"
+#include "pysc2/env/converter/cc/visual_actions.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/sc2api.pb.h"
+#include "s2clientprotocol/spatial.pb.h"
 
 namespace pysc2 {
 
@@ -39,9 +45,35 @@ class VisualConverter {
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   ConvertObservation(const Observation& observation);
 
+  // Slots of the tensors written by ConvertObservation.
+  struct Slots {
+    int available_actions;
+    int screen_stack;
+    // By index in the screen features of the settings.
+    std::vector<int> screen_layers;
+    // Decoded action argument names and the slots of their "action/" keys.
+    std::vector<std::pair<std::string, int>> actions;
+  };
+
+  // Looks up the slots of `layout`, which must include ObservationSpec().
+  Slots ResolveSlots(const ObservationLayout& layout) const;
+
+  // As above, writing the tensors into `output`, which is laid out as the
+  // layout `slots` were resolved from.
+  absl::Status ConvertObservation(const Observation& observation,
+                                  const Slots& slots, ObservationSlots* output);
+
+  // Returns no actions for no_op, and also for an `action` holding nothing
+  // but the function.
   absl::StatusOr<SC2APIProtocol::RequestAction> ConvertAction(
       const absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>& action);
 
+  // As above, for an action which is already unpacked from its tensors.
+  // Unlike a map, `args` always holds every argument, so any function but
+  // no_op is encoded, with the arguments it doesn't set left at 0.
+  absl::StatusOr<SC2APIProtocol::RequestAction> ConvertAction(
+      int function, const VisualActionArgs& args);
+
   absl::StatusOr<absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor>>
   DecodeAction(const SC2APIProtocol::RequestAction& action) const;
 
@@ -49,7 +81,12 @@ class VisualConverter {
   const ConverterSettings settings_;
   const EnvironmentInfo environment_info_;
 
-  std::vector<int> screen_field_indices_;
+  std::vector<FeatureLayerAccessor<SC2APIProtocol::FeatureLayers>>
+      screen_layers_;
+
+  // For the map overload of ConvertObservation.
+  const ObservationLayout observation_layout_;
+  const Slots slots_;
 };
 
 }  // namespace pysc2
@@ -16,11 +16,13 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "dm_env_rpc/v1/dm_env_rpc.pb.h"
 #include "pysc2/env/converter/cc/check_protos_equal.h"
 #include "pysc2/env/converter/cc/features.h"
 #include "pysc2/env/converter/cc/tensor_util.h"
+#include "pysc2/env/converter/cc/visual_actions.h"
 #include "pysc2/env/converter/proto/converter.pb.h"
 #include "s2clientprotocol/common.pb.h"
 #include "s2clientprotocol/spatial.pb.h"
@@ -97,5 +99,33 @@ TEST(VisualConverterTest, FeaturePlanes) {
   }
 }
 
+TEST(VisualConverterTest, ConvertActionWithoutArguments) {
+  VisualConverter visual_converter(MakeSettings());
+
+  // A map with just the function, here select_rect, encodes nothing.
+  absl::flat_hash_map<std::string, dm_env_rpc::v1::Tensor> action;
+  action["function"] = MakeTensor(3);
+  auto converted_or = visual_converter.ConvertAction(action);
+  ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+  EXPECT_EQ(converted_or->actions_size(), 0);
+
+  // Typed arguments can't be missing, so the same function is encoded with
+  // all its arguments at 0.
+  converted_or = visual_converter.ConvertAction(3, VisualActionArgs());
+  ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+  ASSERT_EQ(converted_or->actions_size(), 1);
+  const SC2APIProtocol::ActionSpatialUnitSelectionRect& select_rect =
+      converted_or->actions(0).action_feature_layer().unit_selection_rect();
+  EXPECT_FALSE(select_rect.selection_add());
+  ASSERT_EQ(select_rect.selection_screen_coord_size(), 1);
+  EXPECT_EQ(select_rect.selection_screen_coord(0).p0().x(), 0);
+  EXPECT_EQ(select_rect.selection_screen_coord(0).p1().y(), 0);
+
+  // no_op encodes nothing either way.
+  converted_or = visual_converter.ConvertAction(0, VisualActionArgs());
+  ASSERT_TRUE(converted_or.ok()) << converted_or.status();
+  EXPECT_EQ(converted_or->actions_size(), 0);
+}
+
 }  // namespace
 }  // namespace pysc2
@@ -94,21 +94,11 @@ class Converter:
       A flat mapping of string labels to numpy arrays / or scalars, as
       appropriate.
     """
-    serialized_converted_obs = self._converter.ConvertObservation(
+    # The arrays own the converted tensors' buffers, so no further copies or
+    # proto round trips are needed here.
+    return self._converter.ConvertObservationToNumpy(
         observation.SerializeToString())
 
-    deserialized_converted_obs = {}
-    for k, v in serialized_converted_obs.items():
-      value = dm_env_rpc_pb2.Tensor()
-      value.ParseFromString(v)
-      try:
-        unpacked_value = tensor_utils.unpack_tensor(value)
-        deserialized_converted_obs[k] = unpacked_value
-      except Exception as e:
-        raise Exception(f'Unpacking failed for {k}:{v} - {e}')
-
-    return deserialized_converted_obs
-
   def convert_action(self, action: Mapping[str, Any]) -> converter_pb2.Action:
     """Converts an agent action into an SC2 API action proto.
 
@@ -104,6 +104,18 @@ def _make_observation():
                           data=bytes(bytearray(SCREEN_SIZE * SCREEN_SIZE))))))))
 
 
+def _add_units(observation, tags):
+  raw_data = observation.player.observation.raw_data
+  for tag in tags:
+    raw_data.units.add(
+        tag=tag,
+        unit_type=48,
+        alliance=raw_pb2.Self,
+        display_type=raw_pb2.Visible,
+        health=10 * tag)
+  return observation
+
+
 class RawConverterTest(absltest.TestCase):
 
   def test_action_spec(self):
@@ -186,6 +198,60 @@ class RawConverterTest(absltest.TestCase):
     self.assertEqual(expected.SerializeToString(), action.SerializeToString())
 
 
+  def test_sparse_raw_units(self):
+    settings = _make_converter_settings('raw')
+    settings.raw_settings.sparse_raw_units = True
+    cvr = converter.Converter(
+        settings=settings, environment_info=_make_dummy_env_info())
+
+    obs_spec = cvr.observation_spec()
+    self.assertEqual(obs_spec['raw_units'].shape, (-1, NUM_UNIT_FEATURES + 2))
+    self.assertFalse(hasattr(obs_spec['raw_units'], 'minimum'))
+    self.assertEqual(obs_spec['num_units'].shape, ())
+    self.assertEqual(obs_spec['num_units'].maximum, (MAX_UNIT_COUNT,))
+
+    converted = cvr.convert_observation(
+        _add_units(_make_observation(), [1, 2, 3]))
+    self.assertCountEqual(list(converted), list(obs_spec))
+    for k, v in obs_spec.items():
+      self.assertEqual(converted[k].dtype, v.dtype, msg=k)
+    self.assertEqual(converted['raw_units'].shape, (3, NUM_UNIT_FEATURES + 2))
+    self.assertEqual(converted['num_units'], 3)
+
+  def test_raw_units_delta(self):
+    settings = _make_converter_settings('raw')
+    cvr = converter.Converter(
+        settings=settings, environment_info=_make_dummy_env_info())
+    settings.raw_settings.raw_units_keyframe_interval = 2
+    delta_cvr = converter.Converter(
+        settings=settings, environment_info=_make_dummy_env_info())
+
+    obs_spec = delta_cvr.observation_spec()
+    self.assertNotIn('raw_units', obs_spec)
+    self.assertEqual(obs_spec['raw_units_delta_rows'].shape, (-1,))
+    self.assertEqual(obs_spec['raw_units_delta_values'].shape,
+                     (-1, NUM_UNIT_FEATURES + 2))
+
+    raw_units = np.zeros((MAX_UNIT_COUNT, NUM_UNIT_FEATURES + 2), np.int32)
+    # A keyframe, then a delta frame in which 2 turns into 4 and 3 is gone.
+    for tags, keyframe in (([1, 2, 3], 1), ([1, 4], 0)):
+      observation = _add_units(_make_observation(), tags)
+      expected = cvr.convert_observation(observation)['raw_units']
+      converted = delta_cvr.convert_observation(observation)
+      self.assertCountEqual(list(converted), list(obs_spec))
+      self.assertEqual(converted['raw_units_keyframe'], keyframe)
+      rows = converted['raw_units_delta_rows']
+      values = converted['raw_units_delta_values']
+      self.assertEqual(values.shape, (len(rows), NUM_UNIT_FEATURES + 2))
+      if keyframe:
+        self.assertLen(rows, MAX_UNIT_COUNT)
+      else:
+        self.assertNotEmpty(rows)
+        self.assertLess(len(rows), MAX_UNIT_COUNT)
+      raw_units[rows] = values
+      np.testing.assert_array_equal(raw_units, expected)
+
+
 class VisualConverterTest(absltest.TestCase):
 
   def test_action_spec(self):
@@ -380,6 +446,18 @@ class ConverterTest(parameterized.TestCase):
     for k in converted:
       self.assertIn(k, obs_spec)
 
+  def test_observation_dtypes_match_spec(self, mode):
+    cvr = converter.Converter(
+        settings=_make_converter_settings(mode),
+        environment_info=_make_dummy_env_info())
+
+    obs_spec = cvr.observation_spec()
+    converted = cvr.convert_observation(_make_observation())
+
+    for k, v in converted.items():
+      self.assertIsInstance(v, np.ndarray, msg=k)
+      self.assertEqual(v.dtype, obs_spec[k].dtype, msg=k)
+
 
 if __name__ == '__main__':
   absltest.main()